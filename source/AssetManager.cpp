@@ -0,0 +1,241 @@
+//External includes
+#include <SDL_image.h>
+
+//Project includes
+#include "AssetManager.h"
+#include "MeshCache.h"
+#include "MeshletBuilder.h"
+#include "Stripifier.h"
+#include "Texture.h"
+#include "Utils.h"
+
+//Multithreading includes
+#include <ppl.h>
+
+//Standard includes
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+//Store loaded meshes as strips, one per meshlet, so consecutive triangles share their vertex work
+#define USE_TRIANGLE_STRIPS
+//Keep loaded meshes resident as quantized 18 byte vertices instead of full float vertices
+#define USE_PACKED_VERTICES
+
+namespace dae
+{
+	void AssetManager::RequestTexture(const std::string& path, TextureFormat format)
+	{
+		const std::lock_guard lock{ m_CacheMutex };
+		const std::string key{ GetCacheKey(path, format) };
+		if (m_Textures.contains(key)) return;
+
+		const auto isQueued{ [&key](const auto& pending) { return GetCacheKey(pending.first, pending.second) == key; } };
+		if (std::find_if(m_PendingTextures.begin(), m_PendingTextures.end(), isQueued) != m_PendingTextures.end()) return;
+		m_PendingTextures.emplace_back(path, format);
+	}
+
+	void AssetManager::RequestMesh(const std::string& path)
+	{
+		const std::lock_guard lock{ m_CacheMutex };
+		const std::string key{ GetCacheKey(path) };
+		if (m_Meshes.contains(key)) return;
+
+		const auto isQueued{ [&key](const std::string& pendingPath) { return GetCacheKey(pendingPath) == key; } };
+		if (std::find_if(m_PendingMeshes.begin(), m_PendingMeshes.end(), isQueued) != m_PendingMeshes.end()) return;
+		m_PendingMeshes.push_back(path);
+	}
+
+	AssetManager::~AssetManager()
+	{
+		if (m_LoadThread.joinable()) m_LoadThread.join();
+	}
+
+	float AssetManager::LoadRequested()
+	{
+		std::vector<std::pair<std::string, TextureFormat>> pendingTextures{};
+		std::vector<std::string> pendingMeshes{};
+		{
+			const std::lock_guard lock{ m_CacheMutex };
+			pendingTextures.swap(m_PendingTextures);
+			pendingMeshes.swap(m_PendingMeshes);
+		}
+
+		//IMG_Init lazily loads the image codecs and is not thread safe, so do it once up front
+		IMG_Init(IMG_INIT_PNG);
+		m_NumLoadingAssets += static_cast<uint32_t>(pendingTextures.size() + pendingMeshes.size());
+		return LoadAssets(pendingTextures, pendingMeshes);
+	}
+
+	void AssetManager::LoadRequestedAsync()
+	{
+		//Only one batch is in flight at a time, a new batch waits for the previous one
+		if (m_LoadThread.joinable()) m_LoadThread.join();
+
+		std::vector<std::pair<std::string, TextureFormat>> pendingTextures{};
+		std::vector<std::string> pendingMeshes{};
+		{
+			const std::lock_guard lock{ m_CacheMutex };
+			pendingTextures.swap(m_PendingTextures);
+			pendingMeshes.swap(m_PendingMeshes);
+		}
+
+		IMG_Init(IMG_INIT_PNG);
+		m_NumLoadingAssets += static_cast<uint32_t>(pendingTextures.size() + pendingMeshes.size());
+		m_LoadThread = std::thread{ [this, pendingTextures{ std::move(pendingTextures) }, pendingMeshes{ std::move(pendingMeshes) }]()
+			{
+				LoadAssets(pendingTextures, pendingMeshes);
+			}
+		};
+	}
+
+	bool AssetManager::IsLoading() const
+	{
+		return m_NumLoadingAssets > 0;
+	}
+
+	float AssetManager::LoadAssets(const std::vector<std::pair<std::string, TextureFormat>>& textures, const std::vector<std::string>& meshes)
+	{
+		const auto startTime{ std::chrono::high_resolution_clock::now() };
+
+		//Every asset is a separate task, the scheduler spreads them over its worker pool
+		//An asset only enters the cache once it is complete, so readers never see a half built texture or mesh
+		const uint32_t numTextures{ static_cast<uint32_t>(textures.size()) };
+		const uint32_t numAssets{ numTextures + static_cast<uint32_t>(meshes.size()) };
+		concurrency::parallel_for(0u, numAssets, [&](uint32_t assetIdx)
+			{
+				if (assetIdx < numTextures)
+				{
+					const auto& [path, format] { textures[assetIdx] };
+					std::shared_ptr<Texture> pTexture{ LoadTexture(path, format) };
+					const std::lock_guard lock{ m_CacheMutex };
+					m_Textures[GetCacheKey(path, format)] = std::move(pTexture);
+				}
+				else
+				{
+					const std::string& path{ meshes[assetIdx - numTextures] };
+					std::shared_ptr<Mesh> pMesh{ LoadMesh(path) };
+					const std::lock_guard lock{ m_CacheMutex };
+					m_Meshes[GetCacheKey(path)] = std::move(pMesh);
+				}
+
+				//Decremented after publishing, so IsLoading returning false means every asset of the batch is visible
+				--m_NumLoadingAssets;
+			}
+		);
+
+		const std::chrono::duration<float> loadTime{ std::chrono::high_resolution_clock::now() - startTime };
+		std::cout << "Loaded " << numAssets << " assets in " << loadTime.count() * 1000.f << " ms\n";
+		return loadTime.count();
+	}
+
+	std::shared_ptr<Texture> AssetManager::GetTexture(const std::string& path, TextureFormat format)
+	{
+		const std::string key{ GetCacheKey(path, format) };
+		{
+			const std::lock_guard lock{ m_CacheMutex };
+			const auto it{ m_Textures.find(key) };
+			if (it != m_Textures.end()) return it->second;
+		}
+
+		std::shared_ptr<Texture> pTexture{ LoadTexture(path, format) };
+		const std::lock_guard lock{ m_CacheMutex };
+		//Another thread might have loaded the same texture in the meantime, keep the first one
+		return m_Textures.try_emplace(key, std::move(pTexture)).first->second;
+	}
+
+	std::shared_ptr<Mesh> AssetManager::GetMesh(const std::string& path)
+	{
+		const std::string key{ GetCacheKey(path) };
+		{
+			const std::lock_guard lock{ m_CacheMutex };
+			const auto it{ m_Meshes.find(key) };
+			if (it != m_Meshes.end()) return it->second;
+		}
+
+		std::shared_ptr<Mesh> pMesh{ LoadMesh(path) };
+		const std::lock_guard lock{ m_CacheMutex };
+		return m_Meshes.try_emplace(key, std::move(pMesh)).first->second;
+	}
+
+	std::shared_ptr<Texture> AssetManager::TryGetTexture(const std::string& path, TextureFormat format)
+	{
+		const std::lock_guard lock{ m_CacheMutex };
+		const auto it{ m_Textures.find(GetCacheKey(path, format)) };
+		return it != m_Textures.end() ? it->second : nullptr;
+	}
+
+	std::shared_ptr<Mesh> AssetManager::TryGetMesh(const std::string& path)
+	{
+		const std::lock_guard lock{ m_CacheMutex };
+		const auto it{ m_Meshes.find(GetCacheKey(path)) };
+		return it != m_Meshes.end() ? it->second : nullptr;
+	}
+
+	void AssetManager::Clear()
+	{
+		//Let a running batch finish, otherwise it would repopulate the cache after clearing
+		if (m_LoadThread.joinable()) m_LoadThread.join();
+
+		const std::lock_guard lock{ m_CacheMutex };
+		m_Textures.clear();
+		m_Meshes.clear();
+		m_PendingTextures.clear();
+		m_PendingMeshes.clear();
+	}
+
+	std::string AssetManager::GetCacheKey(const std::string& path)
+	{
+		//Paths on Windows are case insensitive, "Resources/Vehicle_normal.png" and "Resources\vehicle_normal.png" are the same file
+		std::string key{ std::filesystem::path{ path }.lexically_normal().generic_string() };
+		std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return key;
+	}
+
+	std::string AssetManager::GetCacheKey(const std::string& path, TextureFormat format)
+	{
+		//The same image can be resident in several formats
+		return GetCacheKey(path) + '#' + std::to_string(static_cast<int>(format));
+	}
+
+	std::shared_ptr<Texture> AssetManager::LoadTexture(const std::string& path, TextureFormat format)
+	{
+		std::shared_ptr<Texture> pTexture{ Texture::LoadFromFile(path, format) };
+		if (!pTexture) std::cout << "Failed to load texture " << path << "\n";
+		return pTexture;
+	}
+
+	std::shared_ptr<Mesh> AssetManager::LoadMesh(const std::string& path)
+	{
+		//A valid binary cache is mapped as is, no parsing and no tangent generation
+		const std::string cachePath{ MeshCache::GetCachePath(path) };
+		std::shared_ptr<Mesh> pMesh{ std::make_shared<Mesh>() };
+		if (MeshCache::Load(cachePath, path, *pMesh)) return pMesh;
+
+		std::vector<Vertex> vertices{};
+		std::vector<uint32_t> indices{};
+		if (!Utils::ParseOBJ(path, vertices, indices))
+		{
+			std::cout << "Failed to load mesh " << path << "\n";
+			return nullptr;
+		}
+
+		//Clustering and stripification reorder the indices, so they run before the cache is written and never again after
+		Stripifier::WeldVertices(vertices, indices);
+		std::vector<Meshlet> meshlets{ MeshletBuilder::Build(vertices, indices) };
+#ifdef USE_PACKED_VERTICES
+		const VertexFormat vertexFormat{ VertexFormat::Packed };
+#else
+		const VertexFormat vertexFormat{ VertexFormat::Float };
+#endif
+#ifdef USE_TRIANGLE_STRIPS
+		indices = Stripifier::Build(indices, meshlets);
+		*pMesh = Mesh::Create(std::move(vertices), std::move(indices), PrimitiveTopology::TriangleStrip, std::move(meshlets), vertexFormat);
+#else
+		*pMesh = Mesh::Create(std::move(vertices), std::move(indices), PrimitiveTopology::TriangleList, std::move(meshlets), vertexFormat);
+#endif
+		if (!MeshCache::Write(*pMesh, cachePath, path)) std::cout << "Failed to write mesh cache " << cachePath << "\n";
+		return pMesh;
+	}
+}
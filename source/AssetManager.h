@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace dae
+{
+	class Texture;
+	struct Mesh;
+	enum class TextureFormat;
+
+	class AssetManager final
+	{
+	public:
+		AssetManager() = default;
+		~AssetManager();
+
+		AssetManager(const AssetManager&) = delete;
+		AssetManager(AssetManager&&) noexcept = delete;
+		AssetManager& operator=(const AssetManager&) = delete;
+		AssetManager& operator=(AssetManager&&) noexcept = delete;
+
+		//Queue assets for LoadRequested, paths that are already cached or queued are ignored
+		void RequestTexture(const std::string& path, TextureFormat format);
+		void RequestMesh(const std::string& path);
+
+		//Decodes all queued assets concurrently and returns the elapsed time in seconds
+		float LoadRequested();
+		//Decodes all queued assets on a background thread, each asset is published as soon as it is fully built
+		void LoadRequestedAsync();
+		bool IsLoading() const;
+
+		//Returns the cached asset, loading it on the calling thread when it was never requested
+		std::shared_ptr<Texture> GetTexture(const std::string& path, TextureFormat format);
+		std::shared_ptr<Mesh> GetMesh(const std::string& path);
+
+		//Never blocks, returns nullptr while the asset is still loading or when it failed to load
+		std::shared_ptr<Texture> TryGetTexture(const std::string& path, TextureFormat format);
+		std::shared_ptr<Mesh> TryGetMesh(const std::string& path);
+
+		void Clear();
+
+	private:
+		std::unordered_map<std::string, std::shared_ptr<Texture>> m_Textures{};
+		std::unordered_map<std::string, std::shared_ptr<Mesh>> m_Meshes{};
+
+		std::vector<std::pair<std::string, TextureFormat>> m_PendingTextures{};
+		std::vector<std::string> m_PendingMeshes{};
+
+		std::mutex m_CacheMutex{};
+
+		std::thread m_LoadThread{};
+		std::atomic<uint32_t> m_NumLoadingAssets{};
+
+		float LoadAssets(const std::vector<std::pair<std::string, TextureFormat>>& textures, const std::vector<std::string>& meshes);
+
+		static std::string GetCacheKey(const std::string& path);
+		static std::string GetCacheKey(const std::string& path, TextureFormat format);
+		static std::shared_ptr<Texture> LoadTexture(const std::string& path, TextureFormat format);
+		static std::shared_ptr<Mesh> LoadMesh(const std::string& path);
+	};
+}
@@ -1,6 +1,11 @@
 #pragma once
+#include "FloatPacket.h"
 #include "Math.h"
 #include "vector"
+#include <limits>
+#include <memory>
+#include <span>
+#include <type_traits>
 
 namespace dae
 {
@@ -24,19 +29,311 @@ namespace dae
 		Vector3 viewDirection{};
 	};
 
+	//Interpolated attributes of a packet of pixels, one lane per pixel
+	struct Vertex_OutPacket
+	{
+		Vector2Packet uv{};
+		Vector3Packet normal{};
+		Vector3Packet tangent{};
+		Vector3Packet viewDirection{};
+		Vector3Packet worldPosition{};
+	};
+
+	//Vertex_Out attributes a shader can ask the rasterizer to interpolate, combined as bit flags
+	namespace Varyings
+	{
+		constexpr uint32_t None{ 0 };
+		constexpr uint32_t UV{ 1u << 0 };
+		constexpr uint32_t Normal{ 1u << 1 };
+		constexpr uint32_t Tangent{ 1u << 2 };
+		constexpr uint32_t ViewDirection{ 1u << 3 };
+		//Shares its interpolation with the view direction, which runs from the camera to the surface before it is normalized
+		constexpr uint32_t WorldPosition{ 1u << 4 };
+	}
+
+	//Compact resident vertex, 18 instead of 68 bytes
+	//Positions are unorm16 inside the mesh bounds, uvs unorm16 inside the mesh uv range, normal and tangent octahedral snorm16
+	struct PackedVertex
+	{
+		uint16_t position[3]{};
+		uint16_t uv[2]{};
+		int16_t normal[2]{};
+		int16_t tangent[2]{};
+	};
+
+	enum class VertexFormat
+	{
+		Float,
+		Packed
+	};
+
+	namespace VertexQuantization
+	{
+		constexpr float UnormScale{ 65535.f };
+		constexpr float SnormScale{ 32767.f };
+
+		inline uint16_t QuantizeUnorm(float value, float min, float max)
+		{
+			const float range{ max - min };
+			return static_cast<uint16_t>(range > 0.f ? Saturate((value - min) / range) * UnormScale + 0.5f : 0.f);
+		}
+
+		//Folds the unit vector onto the octahedron and unfolds that onto a square, 16 bits per axis keep the error far below a texel
+		inline void EncodeOctahedral(const Vector3& v, int16_t encoded[2])
+		{
+			const float length{ std::abs(v.x) + std::abs(v.y) + std::abs(v.z) };
+			if (length <= 0.f)
+			{
+				encoded[0] = encoded[1] = 0;
+				return;
+			}
+
+			const float invLength{ 1.f / length };
+			float x{ v.x * invLength };
+			float y{ v.y * invLength };
+			if (v.z < 0.f)
+			{
+				const float foldedX{ (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f) };
+				y = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+				x = foldedX;
+			}
+			encoded[0] = static_cast<int16_t>(std::round(Clamp(x, -1.f, 1.f) * SnormScale));
+			encoded[1] = static_cast<int16_t>(std::round(Clamp(y, -1.f, 1.f) * SnormScale));
+		}
+
+		inline Vector3 DecodeOctahedral(const int16_t encoded[2])
+		{
+			Vector3 v{ encoded[0] / SnormScale, encoded[1] / SnormScale, 0.f };
+			v.z = 1.f - std::abs(v.x) - std::abs(v.y);
+			if (v.z < 0.f)
+			{
+				const float foldedX{ (1.f - std::abs(v.y)) * (v.x >= 0.f ? 1.f : -1.f) };
+				v.y = (1.f - std::abs(v.x)) * (v.y >= 0.f ? 1.f : -1.f);
+				v.x = foldedX;
+			}
+			return v.Normalized();
+		}
+	}
+
 	enum class PrimitiveTopology
 	{
 		TriangleList,
 		TriangleStrip
 	};
 
-	struct Mesh
+	enum class IndexFormat
+	{
+		UInt16,
+		UInt32
+	};
+
+	//Ends the current strip, the next index starts a new one with the winding reset
+	template<typename IndexType>
+	constexpr IndexType PrimitiveRestartIndex{ std::numeric_limits<IndexType>::max() };
+
+	//Cluster of neighbouring triangles that is culled as a whole, bounds are in object space
+	struct Meshlet
+	{
+		uint32_t firstIndex{};
+		uint32_t numIndices{};
+		Vector3 center{};
+		float radius{};
+		//Sine of the normal cone's half angle, 1 when the triangles face too many ways to ever be back facing together
+		Vector3 coneAxis{};
+		float coneCutoff{ 1.f };
+	};
+
+	enum class LightType
+	{
+		Point,
+		Spot
+	};
+
+	//Local light with a finite range, its contribution fades to zero at the range so it can be binned
+	struct Light
+	{
+		LightType type{ LightType::Point };
+		Vector3 position{};
+		//Spot lights only, the way the cone points
+		Vector3 direction{ Vector3::UnitZ };
+		ColorRGB color{ colors::White };
+		float intensity{ 1.f };
+		float range{ 10.f };
+		//Spot lights only, full intensity inside the inner cone and none outside the outer one
+		float cosInnerAngle{ 1.f };
+		float cosOuterAngle{ 0.f };
+	};
+
+	//Owning storage for geometry that was built in memory instead of mapped from the mesh cache
+	struct MeshGeometry
 	{
 		std::vector<Vertex> vertices{};
-		std::vector<uint32_t> indices{};
+		std::vector<PackedVertex> packedVertices{};
+		std::vector<uint16_t> indices16{};
+		std::vector<uint32_t> indices32{};
+		std::vector<Meshlet> meshlets{};
+	};
+
+	struct Mesh
+	{
+		//Views into the shared geometry, copying a mesh never copies its vertices
+		//Only the view matching the vertex format is set
+		VertexFormat vertexFormat{ VertexFormat::Float };
+		std::span<const Vertex> vertices{};
+		std::span<const PackedVertex> packedVertices{};
+		//Only the view matching the index format is set
+		IndexFormat indexFormat{ IndexFormat::UInt32 };
+		std::span<const uint16_t> indices16{};
+		std::span<const uint32_t> indices32{};
+		//Each meshlet owns a contiguous range of the index buffer, triangles for lists and whole strips for strips
+		std::span<const Meshlet> meshlets{};
 		PrimitiveTopology primitiveTopology{ PrimitiveTopology::TriangleStrip };
 
+		//Keeps the memory behind the views alive, a MeshGeometry or a mapped cache file
+		std::shared_ptr<const void> pGeometry{};
+		Vector3 boundsMin{};
+		Vector3 boundsMax{};
+		//Range the packed uvs are quantized to
+		Vector2 uvMin{};
+		Vector2 uvMax{};
+
 		std::vector<Vertex_Out> vertices_out{};
 		Matrix worldMatrix{};
+
+		//Meshes that fit 16-bit indices store them that way, the largest value stays free for the primitive restart
+		static Mesh Create(std::vector<Vertex>&& vertices, std::vector<uint32_t>&& indices, PrimitiveTopology primitiveTopology, std::vector<Meshlet>&& meshlets = {},
+			VertexFormat vertexFormat = VertexFormat::Float)
+		{
+			const std::shared_ptr<MeshGeometry> pGeometry{ std::make_shared<MeshGeometry>() };
+			pGeometry->vertices = std::move(vertices);
+			pGeometry->meshlets = std::move(meshlets);
+
+			Mesh mesh{};
+			mesh.vertices = pGeometry->vertices;
+			mesh.CalculateBounds();
+			if (vertexFormat == VertexFormat::Packed)
+			{
+				mesh.PackVertices(pGeometry->vertices, pGeometry->packedVertices);
+				pGeometry->vertices = {};
+				mesh.vertices = {};
+				mesh.packedVertices = pGeometry->packedVertices;
+				mesh.vertexFormat = VertexFormat::Packed;
+			}
+
+			if (mesh.GetNumVertices() < PrimitiveRestartIndex<uint16_t>)
+			{
+				pGeometry->indices16.reserve(indices.size());
+				for (uint32_t index : indices)
+				{
+					pGeometry->indices16.push_back(index == PrimitiveRestartIndex<uint32_t> ? PrimitiveRestartIndex<uint16_t> : static_cast<uint16_t>(index));
+				}
+				mesh.indexFormat = IndexFormat::UInt16;
+				mesh.indices16 = pGeometry->indices16;
+			}
+			else
+			{
+				pGeometry->indices32 = std::move(indices);
+				mesh.indexFormat = IndexFormat::UInt32;
+				mesh.indices32 = pGeometry->indices32;
+			}
+
+			mesh.meshlets = pGeometry->meshlets;
+			mesh.primitiveTopology = primitiveTopology;
+			mesh.pGeometry = pGeometry;
+			return mesh;
+		}
+
+		//Axis aligned box with flat shaded faces, stands in for meshes that are still streaming in
+		static Mesh CreateBox(const Vector3& boundsMin, const Vector3& boundsMax)
+		{
+			const Vector3 faceNormals[]{ Vector3::UnitX, -Vector3::UnitX, Vector3::UnitY, -Vector3::UnitY, Vector3::UnitZ, -Vector3::UnitZ };
+			const Vector3 center{ (boundsMin + boundsMax) * 0.5f };
+			const Vector3 extents{ (boundsMax - boundsMin) * 0.5f };
+
+			std::vector<Vertex> vertices{};
+			std::vector<uint32_t> indices{};
+			vertices.reserve(24);
+			indices.reserve(36);
+			for (const Vector3& normal : faceNormals)
+			{
+				//Tangent, binormal and normal form a right handed frame, so every face winds the same way around its normal
+				const Vector3 tangent{ std::abs(normal.y) > 0.f ? Vector3::UnitX : Vector3::Cross(Vector3::UnitY, normal) };
+				const Vector3 binormal{ Vector3::Cross(normal, tangent) };
+
+				const uint32_t firstIdx{ static_cast<uint32_t>(vertices.size()) };
+				const Vector2 corners[]{ { -1.f, -1.f }, { 1.f, -1.f }, { 1.f, 1.f }, { -1.f, 1.f } };
+				for (const Vector2& corner : corners)
+				{
+					const Vector3 offset{ normal + tangent * corner.x + binormal * corner.y };
+					Vertex vertex{};
+					vertex.position = center + Vector3{ offset.x * extents.x, offset.y * extents.y, offset.z * extents.z };
+					vertex.uv = Vector2{ (corner.x + 1.f) * 0.5f, (corner.y + 1.f) * 0.5f };
+					vertex.normal = normal;
+					vertex.tangent = tangent;
+					vertices.push_back(vertex);
+				}
+				indices.insert(indices.end(), { firstIdx, firstIdx + 1, firstIdx + 2, firstIdx, firstIdx + 2, firstIdx + 3 });
+			}
+			return Create(std::move(vertices), std::move(indices), PrimitiveTopology::TriangleList);
+		}
+
+		size_t GetNumVertices() const
+		{
+			return vertexFormat == VertexFormat::Packed ? packedVertices.size() : vertices.size();
+		}
+
+		//Maps packed positions from 0..65535 back into the bounds, meant to be put in front of the world matrix
+		Matrix GetDequantizationMatrix() const
+		{
+			return Matrix::CreateScale((boundsMax - boundsMin) / VertexQuantization::UnormScale) * Matrix::CreateTranslation(boundsMin);
+		}
+
+		void PackVertices(std::span<const Vertex> vertices_in, std::vector<PackedVertex>& packedVertices_out)
+		{
+			uvMin = uvMax = vertices_in.empty() ? Vector2{} : vertices_in[0].uv;
+			for (const Vertex& vertex : vertices_in)
+			{
+				uvMin = Vector2::Min(uvMin, vertex.uv);
+				uvMax = Vector2::Max(uvMax, vertex.uv);
+			}
+
+			packedVertices_out.resize(vertices_in.size());
+			for (size_t vertIdx{}; vertIdx < vertices_in.size(); ++vertIdx)
+			{
+				const Vertex& vertex{ vertices_in[vertIdx] };
+				PackedVertex& packedVertex{ packedVertices_out[vertIdx] };
+				packedVertex.position[0] = VertexQuantization::QuantizeUnorm(vertex.position.x, boundsMin.x, boundsMax.x);
+				packedVertex.position[1] = VertexQuantization::QuantizeUnorm(vertex.position.y, boundsMin.y, boundsMax.y);
+				packedVertex.position[2] = VertexQuantization::QuantizeUnorm(vertex.position.z, boundsMin.z, boundsMax.z);
+				packedVertex.uv[0] = VertexQuantization::QuantizeUnorm(vertex.uv.x, uvMin.x, uvMax.x);
+				packedVertex.uv[1] = VertexQuantization::QuantizeUnorm(vertex.uv.y, uvMin.y, uvMax.y);
+				VertexQuantization::EncodeOctahedral(vertex.normal, packedVertex.normal);
+				VertexQuantization::EncodeOctahedral(vertex.tangent, packedVertex.tangent);
+			}
+		}
+
+		size_t GetNumIndices() const
+		{
+			return indexFormat == IndexFormat::UInt16 ? indices16.size() : indices32.size();
+		}
+
+		template<typename IndexType>
+		std::span<const IndexType> GetIndices() const
+		{
+			if constexpr (std::is_same_v<IndexType, uint16_t>) return indices16;
+			else return indices32;
+		}
+
+		void CalculateBounds()
+		{
+			if (vertices.empty()) return;
+
+			boundsMin = boundsMax = vertices[0].position;
+			for (const Vertex& vertex : vertices)
+			{
+				boundsMin = Vector3{ std::min(boundsMin.x, vertex.position.x), std::min(boundsMin.y, vertex.position.y), std::min(boundsMin.z, vertex.position.z) };
+				boundsMax = Vector3{ std::max(boundsMax.x, vertex.position.x), std::max(boundsMax.y, vertex.position.y), std::max(boundsMax.z, vertex.position.z) };
+			}
+		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "DepthRasterizer.h"
+#include "DataTypes.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <bit>
+#include <ppl.h>
+
+namespace dae
+{
+	namespace DepthRasterizer
+	{
+		void RasterizeTriangle(const DepthTarget& target, const Vector3& vertex0, const Vector3& vertex1, const Vector3& vertex2)
+		{
+			//Mirrored triangles are drawn with two of their vertices swapped, the depth plane does not care about winding
+			const Vector2 screenVertex0{ vertex0.x, vertex0.y };
+			Vector2 screenVertex1{ vertex1.x, vertex1.y };
+			Vector2 screenVertex2{ vertex2.x, vertex2.y };
+			float depth1{ vertex1.z };
+			float depth2{ vertex2.z };
+			float doubleArea{ Vector2::Cross(screenVertex1 - screenVertex0, screenVertex2 - screenVertex0) };
+			if (doubleArea < 0.f)
+			{
+				std::swap(screenVertex1, screenVertex2);
+				std::swap(depth1, depth2);
+				doubleArea = -doubleArea;
+			}
+			if (!(doubleArea > 0.f)) return;
+
+			const Vector2 targetSize{ static_cast<float>(target.width), static_cast<float>(target.height) };
+			const Vector2 boundingBoxMin{ Vector2::Max(Vector2::Zero, Vector2::Min(Vector2::Min(screenVertex0, Vector2::Min(screenVertex1, screenVertex2)), targetSize)) };
+			const Vector2 boundingBoxMax{ Vector2::Max(Vector2::Zero, Vector2::Min(Vector2::Max(screenVertex0, Vector2::Max(screenVertex1, screenVertex2)), targetSize)) };
+
+			//Same plane setup as the color pass, relative to the first vertex
+			using GeometryUtils::PlaneEquation;
+			const float invDoubleArea{ 1.f / doubleArea };
+			const PlaneEquation weightPlaneV0{ PlaneEquation::FromEdge(screenVertex1, screenVertex2, screenVertex0, invDoubleArea) };
+			const PlaneEquation weightPlaneV1{ PlaneEquation::FromEdge(screenVertex2, screenVertex0, screenVertex0, invDoubleArea) };
+			const PlaneEquation weightPlaneV2{ PlaneEquation::FromEdge(screenVertex0, screenVertex1, screenVertex0, invDoubleArea) };
+			const PlaneEquation depthPlane{ PlaneEquation::FromWeights(weightPlaneV0, weightPlaneV1, weightPlaneV2, vertex0.z, depth1, depth2) };
+
+			const FloatPacket weightStepV0{ weightPlaneV0.dx * PacketWidth };
+			const FloatPacket weightStepV1{ weightPlaneV1.dx * PacketWidth };
+			const FloatPacket weightStepV2{ weightPlaneV2.dx * PacketWidth };
+			const FloatPacket depthStep{ depthPlane.dx * PacketWidth };
+			const int firstX{ static_cast<int>(boundingBoxMin.x) };
+			for (int py{ static_cast<int>(boundingBoxMin.y) }; py < boundingBoxMax.y; ++py)
+			{
+				const float planeX{ firstX - screenVertex0.x };
+				const float planeY{ py - screenVertex0.y };
+				FloatPacket weightV0{ weightPlaneV0.EvaluatePacket(planeX, planeY) };
+				FloatPacket weightV1{ weightPlaneV1.EvaluatePacket(planeX, planeY) };
+				FloatPacket weightV2{ weightPlaneV2.EvaluatePacket(planeX, planeY) };
+				FloatPacket depth{ depthPlane.EvaluatePacket(planeX, planeY) };
+				FloatPacket pixelX{ FloatPacket{ static_cast<float>(firstX) } + FloatPacket::LaneIndices() };
+
+				float* pDepthRow{ target.pDepth + py * target.width };
+				for (int px{ firstX }; px < boundingBoxMax.x; px += PacketWidth)
+				{
+					const FloatPacket isInside{ (weightV0 >= 0.f) & (weightV1 >= 0.f) & (weightV2 >= 0.f) & (pixelX < boundingBoxMax.x) };
+					uint32_t laneMask{ isInside.GetMask() };
+					if (laneMask != 0)
+					{
+						//Lanes are written one by one, a packet wide store would race with triangles drawn next to this one
+						float depths[PacketWidth];
+						Max(depth, 0.f).Store(depths);
+						for (; laneMask != 0; laneMask &= laneMask - 1)
+						{
+							const int lane{ std::countr_zero(laneMask) };
+							float& bufferDepth{ pDepthRow[px + lane] };
+							if (depths[lane] < bufferDepth) bufferDepth = depths[lane];
+						}
+					}
+
+					weightV0 += weightStepV0;
+					weightV1 += weightStepV1;
+					weightV2 += weightStepV2;
+					depth += depthStep;
+					pixelX += FloatPacket{ static_cast<float>(PacketWidth) };
+				}
+			}
+		}
+
+		template<typename IndexType>
+		static void RasterizeIndices(const DepthTarget& target, std::span<const Vector3> vertices, std::span<const IndexType> indices, PrimitiveTopology topology)
+		{
+			//Triangles with a vertex beyond the far side of the target are skipped, like the color pass does outside the frustum
+			const auto drawTriangle{ [&](uint32_t vertIdx0, uint32_t vertIdx1, uint32_t vertIdx2)
+				{
+					if (vertices[vertIdx0].z > 1.f || vertices[vertIdx1].z > 1.f || vertices[vertIdx2].z > 1.f) return;
+					RasterizeTriangle(target, vertices[vertIdx0], vertices[vertIdx1], vertices[vertIdx2]);
+				}
+			};
+
+			const uint32_t numIndices{ static_cast<uint32_t>(indices.size()) };
+			if (topology == PrimitiveTopology::TriangleList)
+			{
+				concurrency::parallel_for(0u, numIndices / 3, [&](uint32_t triIdx)
+					{
+						drawTriangle(indices[triIdx * 3], indices[triIdx * 3 + 1], indices[triIdx * 3 + 2]);
+					}
+				);
+				return;
+			}
+
+			//Runs start at the next strip after their nominal start, so no strip is split between runs
+			constexpr uint32_t indicesPerRun{ 512 };
+			const uint32_t numRuns{ (numIndices + indicesPerRun - 1) / indicesPerRun };
+			const auto getRunStart{ [indices, numIndices](uint32_t runIdx)
+				{
+					uint32_t idx{ runIdx * indicesPerRun };
+					if (idx == 0 || idx >= numIndices) return std::min(idx, numIndices);
+					while (idx < numIndices && indices[idx - 1] != PrimitiveRestartIndex<IndexType>) ++idx;
+					return idx;
+				}
+			};
+			concurrency::parallel_for(0u, numRuns, [&](uint32_t runIdx)
+				{
+					uint32_t vertIdx0{}, vertIdx1{};
+					uint32_t numStripVertices{};
+					const uint32_t runEnd{ getRunStart(runIdx + 1) };
+					for (uint32_t idx{ getRunStart(runIdx) }; idx < runEnd; ++idx)
+					{
+						const IndexType index{ indices[idx] };
+						if (index == PrimitiveRestartIndex<IndexType>)
+						{
+							numStripVertices = 0;
+							continue;
+						}
+
+						//Both windings are drawn, so odd triangles need no swap
+						if (numStripVertices >= 2) drawTriangle(vertIdx0, vertIdx1, index);
+						vertIdx0 = vertIdx1;
+						vertIdx1 = index;
+						++numStripVertices;
+					}
+				}
+			);
+		}
+
+		void RasterizeMesh(const DepthTarget& target, std::span<const Vector3> vertices, std::span<const uint16_t> indices, PrimitiveTopology topology)
+		{
+			RasterizeIndices<uint16_t>(target, vertices, indices, topology);
+		}
+
+		void RasterizeMesh(const DepthTarget& target, std::span<const Vector3> vertices, std::span<const uint32_t> indices, PrimitiveTopology topology)
+		{
+			RasterizeIndices<uint32_t>(target, vertices, indices, topology);
+		}
+	}
+}
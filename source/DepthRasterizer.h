@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <span>
+
+namespace dae
+{
+	struct Vector3;
+	enum class PrimitiveTopology;
+
+	//Lean raster kernel that only writes depth, no attributes are set up and no color is written
+	//Used for the shadow map, and fit for occlusion buffers or depth prepasses
+	namespace DepthRasterizer
+	{
+		struct DepthTarget
+		{
+			float* pDepth{};
+			int width{};
+			int height{};
+		};
+
+		//Vertices are in target pixels with the depth in z, both windings are drawn and depths below zero are clamped to it
+		void RasterizeTriangle(const DepthTarget& target, const Vector3& vertex0, const Vector3& vertex1, const Vector3& vertex2);
+
+		//Whole index buffer, strips are cut at primitive restarts, walked in parallel like the color pass
+		void RasterizeMesh(const DepthTarget& target, std::span<const Vector3> vertices, std::span<const uint16_t> indices, PrimitiveTopology topology);
+		void RasterizeMesh(const DepthTarget& target, std::span<const Vector3> vertices, std::span<const uint32_t> indices, PrimitiveTopology topology);
+	}
+}
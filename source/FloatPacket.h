@@ -0,0 +1,259 @@
+#pragma once
+#include <cstdint>
+#include <immintrin.h>
+#include "Math.h"
+
+namespace dae
+{
+	//Pixels are shaded in packets, eight lanes when the compiler may use AVX2 and four with the SSE2 every x64 CPU has
+#ifdef __AVX2__
+	constexpr int PacketWidth{ 8 };
+	using PacketRegister = __m256;
+	using PacketIntRegister = __m256i;
+#else
+	constexpr int PacketWidth{ 4 };
+	using PacketRegister = __m128;
+	using PacketIntRegister = __m128i;
+#endif
+
+	//Bit i of a lane mask stands for lane i
+	constexpr uint32_t FullLaneMask{ (1u << PacketWidth) - 1 };
+
+	//The color pass packs 2x2 pixel quads side by side, a packet spans QuadColumns pixels over two rows
+	//Lanes 0 to 3 are the first quad, top left, top right, bottom left and bottom right
+	constexpr int QuadColumns{ PacketWidth / 2 };
+	constexpr int GetQuadLaneX(int lane) { return (lane >> 2) * 2 + (lane & 1); }
+	constexpr int GetQuadLaneY(int lane) { return (lane >> 1) & 1; }
+
+	struct FloatPacket
+	{
+		PacketRegister value{};
+
+		FloatPacket() = default;
+		FloatPacket(PacketRegister v) : value{ v } {}
+#ifdef __AVX2__
+		FloatPacket(float v) : value{ _mm256_set1_ps(v) } {}
+
+		static FloatPacket Load(const float* pValues) { return _mm256_loadu_ps(pValues); }
+		void Store(float* pValues) const { _mm256_storeu_ps(pValues, value); }
+		//0, 1, 2, ... per lane
+		static FloatPacket LaneIndices() { return _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f); }
+		//Pixel offset of every lane in quad layout
+		static FloatPacket QuadLaneX() { return _mm256_setr_ps(0.f, 1.f, 0.f, 1.f, 2.f, 3.f, 2.f, 3.f); }
+		static FloatPacket QuadLaneY() { return _mm256_setr_ps(0.f, 0.f, 1.f, 1.f, 0.f, 0.f, 1.f, 1.f); }
+		static FloatPacket FromMask(uint32_t laneMask)
+		{
+			const __m256i laneBits{ _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128) };
+			const __m256i mask{ _mm256_set1_epi32(static_cast<int>(laneMask)) };
+			return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(mask, laneBits), laneBits));
+		}
+		uint32_t GetMask() const { return static_cast<uint32_t>(_mm256_movemask_ps(value)); }
+		//Lane i reads pBase[indices[i]], the indices are whole numbers stored as floats
+		static FloatPacket Gather(const float* pBase, const FloatPacket& indices) { return _mm256_i32gather_ps(pBase, _mm256_cvttps_epi32(indices.value), 4); }
+#else
+		FloatPacket(float v) : value{ _mm_set1_ps(v) } {}
+
+		static FloatPacket Load(const float* pValues) { return _mm_loadu_ps(pValues); }
+		void Store(float* pValues) const { _mm_storeu_ps(pValues, value); }
+		//0, 1, 2, ... per lane
+		static FloatPacket LaneIndices() { return _mm_setr_ps(0.f, 1.f, 2.f, 3.f); }
+		//Pixel offset of every lane in quad layout
+		static FloatPacket QuadLaneX() { return _mm_setr_ps(0.f, 1.f, 0.f, 1.f); }
+		static FloatPacket QuadLaneY() { return _mm_setr_ps(0.f, 0.f, 1.f, 1.f); }
+		static FloatPacket FromMask(uint32_t laneMask)
+		{
+			const __m128i laneBits{ _mm_setr_epi32(1, 2, 4, 8) };
+			const __m128i mask{ _mm_set1_epi32(static_cast<int>(laneMask)) };
+			return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(mask, laneBits), laneBits));
+		}
+		uint32_t GetMask() const { return static_cast<uint32_t>(_mm_movemask_ps(value)); }
+		//Lane i reads pBase[indices[i]], the indices are whole numbers stored as floats
+		//SSE has no gather, the lanes are read one by one
+		static FloatPacket Gather(const float* pBase, const FloatPacket& indices)
+		{
+			alignas(16) int32_t offsets[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(offsets), _mm_cvttps_epi32(indices.value));
+			return _mm_setr_ps(pBase[offsets[0]], pBase[offsets[1]], pBase[offsets[2]], pBase[offsets[3]]);
+		}
+#endif
+	};
+
+#ifdef __AVX2__
+	inline FloatPacket operator+(const FloatPacket& a, const FloatPacket& b) { return _mm256_add_ps(a.value, b.value); }
+	inline FloatPacket operator-(const FloatPacket& a, const FloatPacket& b) { return _mm256_sub_ps(a.value, b.value); }
+	inline FloatPacket operator*(const FloatPacket& a, const FloatPacket& b) { return _mm256_mul_ps(a.value, b.value); }
+	inline FloatPacket operator/(const FloatPacket& a, const FloatPacket& b) { return _mm256_div_ps(a.value, b.value); }
+	inline FloatPacket operator&(const FloatPacket& a, const FloatPacket& b) { return _mm256_and_ps(a.value, b.value); }
+	inline FloatPacket operator|(const FloatPacket& a, const FloatPacket& b) { return _mm256_or_ps(a.value, b.value); }
+	inline FloatPacket operator<(const FloatPacket& a, const FloatPacket& b) { return _mm256_cmp_ps(a.value, b.value, _CMP_LT_OQ); }
+	inline FloatPacket operator<=(const FloatPacket& a, const FloatPacket& b) { return _mm256_cmp_ps(a.value, b.value, _CMP_LE_OQ); }
+	inline FloatPacket operator>(const FloatPacket& a, const FloatPacket& b) { return _mm256_cmp_ps(a.value, b.value, _CMP_GT_OQ); }
+	inline FloatPacket operator>=(const FloatPacket& a, const FloatPacket& b) { return _mm256_cmp_ps(a.value, b.value, _CMP_GE_OQ); }
+	inline FloatPacket operator==(const FloatPacket& a, const FloatPacket& b) { return _mm256_cmp_ps(a.value, b.value, _CMP_EQ_OQ); }
+	inline FloatPacket Min(const FloatPacket& a, const FloatPacket& b) { return _mm256_min_ps(a.value, b.value); }
+	inline FloatPacket Max(const FloatPacket& a, const FloatPacket& b) { return _mm256_max_ps(a.value, b.value); }
+	inline FloatPacket Sqrt(const FloatPacket& a) { return _mm256_sqrt_ps(a.value); }
+	//Rounds toward zero, SSE2 only gets there through integers so values have to fit an int32
+	inline FloatPacket Truncate(const FloatPacket& a) { return _mm256_round_ps(a.value, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+	//Lanes of the mask take a, the others b
+	inline FloatPacket Select(const FloatPacket& mask, const FloatPacket& a, const FloatPacket& b) { return _mm256_blendv_ps(b.value, a.value, mask.value); }
+	//Differences to the horizontal and vertical neighbour within each quad, a quad is one 128 bit half
+	inline FloatPacket DDX(const FloatPacket& a) { return _mm256_sub_ps(_mm256_permute_ps(a.value, _MM_SHUFFLE(3, 3, 1, 1)), _mm256_permute_ps(a.value, _MM_SHUFFLE(2, 2, 0, 0))); }
+	inline FloatPacket DDY(const FloatPacket& a) { return _mm256_sub_ps(_mm256_permute_ps(a.value, _MM_SHUFFLE(3, 2, 3, 2)), _mm256_permute_ps(a.value, _MM_SHUFFLE(1, 0, 1, 0))); }
+#else
+	inline FloatPacket operator+(const FloatPacket& a, const FloatPacket& b) { return _mm_add_ps(a.value, b.value); }
+	inline FloatPacket operator-(const FloatPacket& a, const FloatPacket& b) { return _mm_sub_ps(a.value, b.value); }
+	inline FloatPacket operator*(const FloatPacket& a, const FloatPacket& b) { return _mm_mul_ps(a.value, b.value); }
+	inline FloatPacket operator/(const FloatPacket& a, const FloatPacket& b) { return _mm_div_ps(a.value, b.value); }
+	inline FloatPacket operator&(const FloatPacket& a, const FloatPacket& b) { return _mm_and_ps(a.value, b.value); }
+	inline FloatPacket operator|(const FloatPacket& a, const FloatPacket& b) { return _mm_or_ps(a.value, b.value); }
+	inline FloatPacket operator<(const FloatPacket& a, const FloatPacket& b) { return _mm_cmplt_ps(a.value, b.value); }
+	inline FloatPacket operator<=(const FloatPacket& a, const FloatPacket& b) { return _mm_cmple_ps(a.value, b.value); }
+	inline FloatPacket operator>(const FloatPacket& a, const FloatPacket& b) { return _mm_cmpgt_ps(a.value, b.value); }
+	inline FloatPacket operator>=(const FloatPacket& a, const FloatPacket& b) { return _mm_cmpge_ps(a.value, b.value); }
+	inline FloatPacket operator==(const FloatPacket& a, const FloatPacket& b) { return _mm_cmpeq_ps(a.value, b.value); }
+	inline FloatPacket Min(const FloatPacket& a, const FloatPacket& b) { return _mm_min_ps(a.value, b.value); }
+	inline FloatPacket Max(const FloatPacket& a, const FloatPacket& b) { return _mm_max_ps(a.value, b.value); }
+	inline FloatPacket Sqrt(const FloatPacket& a) { return _mm_sqrt_ps(a.value); }
+	inline FloatPacket Truncate(const FloatPacket& a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a.value)); }
+	//Lanes of the mask take a, the others b
+	inline FloatPacket Select(const FloatPacket& mask, const FloatPacket& a, const FloatPacket& b) { return _mm_or_ps(_mm_and_ps(mask.value, a.value), _mm_andnot_ps(mask.value, b.value)); }
+	//Differences to the horizontal and vertical neighbour within the quad
+	inline FloatPacket DDX(const FloatPacket& a) { return _mm_sub_ps(_mm_shuffle_ps(a.value, a.value, _MM_SHUFFLE(3, 3, 1, 1)), _mm_shuffle_ps(a.value, a.value, _MM_SHUFFLE(2, 2, 0, 0))); }
+	inline FloatPacket DDY(const FloatPacket& a) { return _mm_sub_ps(_mm_shuffle_ps(a.value, a.value, _MM_SHUFFLE(3, 2, 3, 2)), _mm_shuffle_ps(a.value, a.value, _MM_SHUFFLE(1, 0, 1, 0))); }
+#endif
+
+	inline FloatPacket operator-(const FloatPacket& a) { return FloatPacket{ 0.f } - a; }
+	inline FloatPacket Abs(const FloatPacket& a) { return Max(a, -a); }
+	inline FloatPacket& operator+=(FloatPacket& a, const FloatPacket& b) { return a = a + b; }
+	inline FloatPacket& operator*=(FloatPacket& a, const FloatPacket& b) { return a = a * b; }
+
+	//log2 of positive values, the exponent is read from the float bits and a polynomial fitted on [1, 2) covers the mantissa
+	//The absolute error stays below 2e-5
+	inline FloatPacket Log2(const FloatPacket& x)
+	{
+#ifdef __AVX2__
+		const __m256i bits{ _mm256_castps_si256(x.value) };
+		const FloatPacket exponent{ _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127))) };
+		const FloatPacket mantissa{ _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000))) };
+#else
+		const __m128i bits{ _mm_castps_si128(x.value) };
+		const FloatPacket exponent{ _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127))) };
+		const FloatPacket mantissa{ _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000))) };
+#endif
+		FloatPacket polynomial{ 0.04300496f };
+		polynomial = polynomial * mantissa + -0.40251339f;
+		polynomial = polynomial * mantissa + 1.58947429f;
+		polynomial = polynomial * mantissa + -3.48987855f;
+		polynomial = polynomial * mantissa + 5.04785541f;
+		polynomial = polynomial * mantissa + -2.78792621f;
+		return exponent + polynomial;
+	}
+
+	//2^x, the integer part goes straight into the exponent bits and a polynomial fitted on [0, 1) covers the fraction
+	//The relative error stays below 4e-6
+	inline FloatPacket Exp2(const FloatPacket& x)
+	{
+		const FloatPacket clamped{ Min(Max(x, -126.f), 126.f) };
+#ifdef __AVX2__
+		const FloatPacket whole{ _mm256_floor_ps(clamped.value) };
+		const __m256i exponentBits{ _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(whole.value), _mm256_set1_epi32(127)), 23) };
+		const FloatPacket scale{ _mm256_castsi256_ps(exponentBits) };
+#else
+		//Truncation rounds negative values up, those are moved down by one
+		const FloatPacket truncated{ _mm_cvtepi32_ps(_mm_cvttps_epi32(clamped.value)) };
+		const FloatPacket whole{ truncated - (FloatPacket{ 1.f } & (truncated > clamped)) };
+		const __m128i exponentBits{ _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(whole.value), _mm_set1_epi32(127)), 23) };
+		const FloatPacket scale{ _mm_castsi128_ps(exponentBits) };
+#endif
+		const FloatPacket fraction{ clamped - whole };
+		FloatPacket polynomial{ 0.01367031f };
+		polynomial = polynomial * fraction + 0.05174500f;
+		polynomial = polynomial * fraction + 0.24160436f;
+		polynomial = polynomial * fraction + 0.69297292f;
+		polynomial = polynomial * fraction + 1.00000349f;
+		return polynomial * scale;
+	}
+
+	//base^exponent for bases of zero and up, zero stays zero and like powf anything to the power zero is one
+	inline FloatPacket Pow(const FloatPacket& base, const FloatPacket& exponent)
+	{
+		return Select(exponent == 0.f, 1.f, Select(base > 0.f, Exp2(exponent * Log2(base)), 0.f));
+	}
+
+	//Reference for Pow, powf lane by lane
+	inline FloatPacket PowExact(const FloatPacket& base, const FloatPacket& exponent)
+	{
+		float bases[PacketWidth], exponents[PacketWidth];
+		base.Store(bases);
+		exponent.Store(exponents);
+		for (uint32_t lane{}; lane < PacketWidth; ++lane) bases[lane] = powf(bases[lane], exponents[lane]);
+		return FloatPacket::Load(bases);
+	}
+
+	struct Vector2Packet
+	{
+		FloatPacket x{};
+		FloatPacket y{};
+	};
+
+	inline Vector2Packet DDX(const Vector2Packet& v) { return { DDX(v.x), DDX(v.y) }; }
+	inline Vector2Packet DDY(const Vector2Packet& v) { return { DDY(v.x), DDY(v.y) }; }
+
+	struct Vector3Packet
+	{
+		FloatPacket x{};
+		FloatPacket y{};
+		FloatPacket z{};
+
+		Vector3Packet() = default;
+		Vector3Packet(const FloatPacket& x, const FloatPacket& y, const FloatPacket& z) : x{ x }, y{ y }, z{ z } {}
+		Vector3Packet(const Vector3& v) : x{ v.x }, y{ v.y }, z{ v.z } {}
+
+		Vector3Packet operator+(const Vector3Packet& v) const { return { x + v.x, y + v.y, z + v.z }; }
+		Vector3Packet operator-(const Vector3Packet& v) const { return { x - v.x, y - v.y, z - v.z }; }
+		Vector3Packet operator*(const FloatPacket& s) const { return { x * s, y * s, z * s }; }
+		Vector3Packet operator-() const { return { -x, -y, -z }; }
+
+		static FloatPacket Dot(const Vector3Packet& a, const Vector3Packet& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+		static Vector3Packet Cross(const Vector3Packet& a, const Vector3Packet& b)
+		{
+			return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+		}
+		static Vector3Packet Reflect(const Vector3Packet& v, const Vector3Packet& n) { return v - n * (Dot(v, n) * 2.f); }
+
+		Vector3Packet Normalized() const
+		{
+			return *this * (FloatPacket{ 1.f } / Sqrt(Dot(*this, *this)));
+		}
+	};
+
+	inline Vector3Packet DDX(const Vector3Packet& v) { return { DDX(v.x), DDX(v.y), DDX(v.z) }; }
+	inline Vector3Packet DDY(const Vector3Packet& v) { return { DDY(v.x), DDY(v.y), DDY(v.z) }; }
+
+	struct ColorPacket
+	{
+		FloatPacket r{};
+		FloatPacket g{};
+		FloatPacket b{};
+
+		ColorPacket() = default;
+		ColorPacket(const FloatPacket& r, const FloatPacket& g, const FloatPacket& b) : r{ r }, g{ g }, b{ b } {}
+		ColorPacket(const ColorRGB& c) : r{ c.r }, g{ c.g }, b{ c.b } {}
+
+		ColorPacket operator+(const ColorPacket& c) const { return { r + c.r, g + c.g, b + c.b }; }
+		ColorPacket operator*(const ColorPacket& c) const { return { r * c.r, g * c.g, b * c.b }; }
+		ColorPacket operator*(const FloatPacket& s) const { return { r * s, g * s, b * s }; }
+		ColorPacket& operator+=(const ColorPacket& c) { r += c.r; g += c.g; b += c.b; return *this; }
+
+		//Same as ColorRGB::MaxToOne for every lane
+		void MaxToOne()
+		{
+			const FloatPacket maxValue{ Max(r, Max(g, b)) };
+			const FloatPacket scale{ Select(maxValue > 1.f, FloatPacket{ 1.f } / maxValue, 1.f) };
+			r *= scale;
+			g *= scale;
+			b *= scale;
+		}
+	};
+}
@@ -0,0 +1,273 @@
+#include "ImageBasedLighting.h"
+
+#include <algorithm>
+#include <ppl.h>
+
+namespace dae
+{
+	//Low discrepancy points in [0, 1)^2, every texel uses the same set so the error is smooth instead of noisy
+	static Vector2 Hammersley(uint32_t sampleIdx, uint32_t numSamples)
+	{
+		uint32_t bits{ sampleIdx };
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return Vector2{ (sampleIdx + 0.5f) / numSamples, bits * 2.3283064365386963e-10f };
+	}
+
+	//Half vector around +z, distributed like the GGX lobe of the roughness
+	static Vector3 ImportanceSampleGGX(const Vector2& xi, float roughness)
+	{
+		const float alpha{ roughness * roughness };
+		const float phi{ 2.f * PI * xi.x };
+		const float cosTheta{ sqrtf((1.f - xi.y) / (1.f + (alpha * alpha - 1.f) * xi.y)) };
+		const float sinTheta{ sqrtf(std::max(1.f - cosTheta * cosTheta, 0.f)) };
+		return Vector3{ sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta };
+	}
+
+	//Octahedral map coordinates in [0, 1] to a direction, +y is the center of the map and -y is folded out to its corners
+	static Vector3 DecodeOctahedral(float u, float v)
+	{
+		float x{ u * 2.f - 1.f };
+		float z{ v * 2.f - 1.f };
+		const float y{ 1.f - fabsf(x) - fabsf(z) };
+		if (y < 0.f)
+		{
+			const float foldedX{ (1.f - fabsf(z)) * (x >= 0.f ? 1.f : -1.f) };
+			z = (1.f - fabsf(x)) * (z >= 0.f ? 1.f : -1.f);
+			x = foldedX;
+		}
+		return Vector3{ x, y, z }.Normalized();
+	}
+
+	//Normalization of the nine real spherical harmonics, band 0 to 2
+	static constexpr float SHConstants[9]{ 0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+
+	void ImageBasedLighting::Build(const std::function<ColorRGB(const Vector3&)>& radiance)
+	{
+		BuildBRDFTable();
+		BuildEnvironment(radiance);
+		BuildIrradiance(radiance);
+	}
+
+	void ImageBasedLighting::BuildBRDFTable()
+	{
+		constexpr uint32_t numSamples{ 256 };
+		m_BRDFScale.resize(BRDFTableSize * BRDFTableSize);
+		m_BRDFBias.resize(BRDFTableSize * BRDFTableSize);
+
+		//Rows are roughness, columns the cosine between normal and view
+		concurrency::parallel_for(0, BRDFTableSize, [&](int roughnessIdx)
+			{
+				const float roughness{ (roughnessIdx + 0.5f) / BRDFTableSize };
+				//Schlick's approximation of Smith, with the k that is used for environment lighting
+				const float k{ roughness * roughness * 0.5f };
+				for (int angleIdx{}; angleIdx < BRDFTableSize; ++angleIdx)
+				{
+					const float nDotV{ (angleIdx + 0.5f) / BRDFTableSize };
+					const Vector3 view{ sqrtf(1.f - nDotV * nDotV), 0.f, nDotV };
+
+					float scale{}, bias{};
+					for (uint32_t sampleIdx{}; sampleIdx < numSamples; ++sampleIdx)
+					{
+						const Vector3 halfVector{ ImportanceSampleGGX(Hammersley(sampleIdx, numSamples), roughness) };
+						const float vDotH{ std::max(Vector3::Dot(view, halfVector), 0.f) };
+						const float nDotL{ 2.f * vDotH * halfVector.z - nDotV };
+						if (nDotL <= 0.f) continue;
+
+						const float geometry{ nDotL / (nDotL * (1.f - k) + k) * nDotV / (nDotV * (1.f - k) + k) };
+						//The GGX distribution cancels against the pdf of the samples, what is left weighs the Fresnel terms
+						const float weight{ geometry * vDotH / (halfVector.z * nDotV) };
+						const float fresnel{ powf(1.f - vDotH, 5.f) };
+						scale += (1.f - fresnel) * weight;
+						bias += fresnel * weight;
+					}
+					m_BRDFScale[roughnessIdx * BRDFTableSize + angleIdx] = scale / numSamples;
+					m_BRDFBias[roughnessIdx * BRDFTableSize + angleIdx] = bias / numSamples;
+				}
+			}
+		);
+	}
+
+	void ImageBasedLighting::BuildEnvironment(const std::function<ColorRGB(const Vector3&)>& radiance)
+	{
+		constexpr uint32_t numSamples{ 256 };
+		int numTexels{};
+		for (int levelIdx{}; levelIdx < NumRoughnessLevels; ++levelIdx)
+		{
+			const int size{ std::max(EnvironmentSize >> levelIdx, 8) };
+			m_LevelSizes[levelIdx] = static_cast<float>(size);
+			m_LevelOffsets[levelIdx] = static_cast<float>(numTexels);
+			numTexels += size * size;
+		}
+		m_EnvironmentRed.resize(numTexels);
+		m_EnvironmentGreen.resize(numTexels);
+		m_EnvironmentBlue.resize(numTexels);
+
+		for (int levelIdx{}; levelIdx < NumRoughnessLevels; ++levelIdx)
+		{
+			const int size{ static_cast<int>(m_LevelSizes[levelIdx]) };
+			const int offset{ static_cast<int>(m_LevelOffsets[levelIdx]) };
+			const float roughness{ static_cast<float>(levelIdx) / (NumRoughnessLevels - 1) };
+			concurrency::parallel_for(0, size, [&](int y)
+				{
+					for (int x{}; x < size; ++x)
+					{
+						const Vector3 direction{ DecodeOctahedral((x + 0.5f) / size, (y + 0.5f) / size) };
+						ColorRGB color{};
+						if (levelIdx == 0)
+						{
+							color = radiance(direction);
+						}
+						else
+						{
+							//Normal and view are both taken to be the looked up direction, the usual assumption of the split sum
+							const Vector3 up{ fabsf(direction.y) < 0.999f ? Vector3{ 0.f, 1.f, 0.f } : Vector3{ 1.f, 0.f, 0.f } };
+							const Vector3 tangent{ Vector3::Cross(up, direction).Normalized() };
+							const Vector3 bitangent{ Vector3::Cross(direction, tangent) };
+							float totalWeight{};
+							for (uint32_t sampleIdx{}; sampleIdx < numSamples; ++sampleIdx)
+							{
+								const Vector3 halfVector{ ImportanceSampleGGX(Hammersley(sampleIdx, numSamples), roughness) };
+								const Vector3 worldHalfVector{ tangent * halfVector.x + bitangent * halfVector.y + direction * halfVector.z };
+								const Vector3 lightDirection{ worldHalfVector * (2.f * halfVector.z) - direction };
+								const float nDotL{ Vector3::Dot(direction, lightDirection) };
+								if (nDotL <= 0.f) continue;
+
+								color += radiance(lightDirection) * nDotL;
+								totalWeight += nDotL;
+							}
+							color /= totalWeight;
+						}
+
+						const int texelIdx{ offset + y * size + x };
+						m_EnvironmentRed[texelIdx] = color.r;
+						m_EnvironmentGreen[texelIdx] = color.g;
+						m_EnvironmentBlue[texelIdx] = color.b;
+					}
+				}
+			);
+		}
+	}
+
+	void ImageBasedLighting::BuildIrradiance(const std::function<ColorRGB(const Vector3&)>& radiance)
+	{
+		//Directions spread evenly over the sphere on a Fibonacci spiral, each one stands for the same solid angle
+		constexpr int numSamples{ 4096 };
+		const float goldenAngle{ PI * (3.f - sqrtf(5.f)) };
+		ColorRGB coefficients[9]{};
+		for (int sampleIdx{}; sampleIdx < numSamples; ++sampleIdx)
+		{
+			const float y{ 1.f - 2.f * (sampleIdx + 0.5f) / numSamples };
+			const float radius{ sqrtf(1.f - y * y) };
+			const float x{ cosf(sampleIdx * goldenAngle) * radius };
+			const float z{ sinf(sampleIdx * goldenAngle) * radius };
+			const ColorRGB sample{ radiance(Vector3{ x, y, z }) };
+
+			const float polynomials[9]{ 1.f, y, z, x, x * y, y * z, 3.f * z * z - 1.f, x * z, x * x - y * y };
+			for (int coefficientIdx{}; coefficientIdx < 9; ++coefficientIdx)
+			{
+				coefficients[coefficientIdx] += sample * (SHConstants[coefficientIdx] * polynomials[coefficientIdx]);
+			}
+		}
+
+		//Irradiance is radiance convolved with the clamped cosine, which only scales each band
+		const float bandScales[3]{ PI, 2.f * PI / 3.f, PI / 4.f };
+		const float sampleArea{ 4.f * PI / numSamples };
+		for (int coefficientIdx{}; coefficientIdx < 9; ++coefficientIdx)
+		{
+			const int band{ coefficientIdx == 0 ? 0 : (coefficientIdx < 4 ? 1 : 2) };
+			//The normalization is folded in as well, evaluating is then only the polynomials
+			m_IrradianceCoefficients[coefficientIdx] = coefficients[coefficientIdx] * (sampleArea * bandScales[band] * SHConstants[coefficientIdx]);
+		}
+	}
+
+	void ImageBasedLighting::SampleBRDF(const FloatPacket& nDotV, const FloatPacket& roughness, FloatPacket& scale, FloatPacket& bias) const
+	{
+		const BilinearTaps taps{ GetBilinearTaps(0.f, static_cast<float>(BRDFTableSize), nDotV * BRDFTableSize - 0.5f, roughness * BRDFTableSize - 0.5f) };
+		scale = SampleBilinear(m_BRDFScale.data(), taps);
+		bias = SampleBilinear(m_BRDFBias.data(), taps);
+	}
+
+	ColorPacket ImageBasedLighting::SampleSpecular(const Vector3Packet& direction, const FloatPacket& roughness) const
+	{
+		//Octahedral encoding, the lower hemisphere is folded out to the corners
+		const FloatPacket invLength{ FloatPacket{ 1.f } / (Abs(direction.x) + Abs(direction.y) + Abs(direction.z)) };
+		const FloatPacket x{ direction.x * invLength };
+		const FloatPacket z{ direction.z * invLength };
+		const FloatPacket lowerHemisphere{ direction.y < 0.f };
+		const FloatPacket foldedX{ (FloatPacket{ 1.f } - Abs(z)) * Select(x >= 0.f, 1.f, -1.f) };
+		const FloatPacket foldedZ{ (FloatPacket{ 1.f } - Abs(x)) * Select(z >= 0.f, 1.f, -1.f) };
+		const FloatPacket u{ Select(lowerHemisphere, foldedX, x) * 0.5f + 0.5f };
+		const FloatPacket v{ Select(lowerHemisphere, foldedZ, z) * 0.5f + 0.5f };
+
+		//Blends the two levels around the roughness, each lane can be on levels of its own
+		const FloatPacket level{ Min(Max(roughness, 0.f), 1.f) * static_cast<float>(NumRoughnessLevels - 1) };
+		const FloatPacket lowerLevel{ Min(Truncate(level), static_cast<float>(NumRoughnessLevels - 2)) };
+		const FloatPacket upperWeight{ level - lowerLevel };
+		ColorPacket color{};
+		for (int step{}; step < 2; ++step)
+		{
+			const FloatPacket levelIdx{ lowerLevel + static_cast<float>(step) };
+			const FloatPacket size{ FloatPacket::Gather(m_LevelSizes, levelIdx) };
+			const FloatPacket offset{ FloatPacket::Gather(m_LevelOffsets, levelIdx) };
+			const BilinearTaps taps{ GetBilinearTaps(offset, size, u * size - 0.5f, v * size - 0.5f) };
+			const FloatPacket weight{ step == 0 ? FloatPacket{ 1.f } - upperWeight : upperWeight };
+			color += ColorPacket{ SampleBilinear(m_EnvironmentRed.data(), taps), SampleBilinear(m_EnvironmentGreen.data(), taps),
+				SampleBilinear(m_EnvironmentBlue.data(), taps) } * weight;
+		}
+		return color;
+	}
+
+	ColorPacket ImageBasedLighting::SampleIrradiance(const Vector3Packet& normal) const
+	{
+		const FloatPacket& x{ normal.x };
+		const FloatPacket& y{ normal.y };
+		const FloatPacket& z{ normal.z };
+		const FloatPacket polynomials[9]{ 1.f, y, z, x, x * y, y * z, z * z * 3.f - 1.f, x * z, x * x - y * y };
+
+		ColorPacket irradiance{};
+		for (int coefficientIdx{}; coefficientIdx < 9; ++coefficientIdx)
+		{
+			irradiance += ColorPacket{ m_IrradianceCoefficients[coefficientIdx] } * polynomials[coefficientIdx];
+		}
+		//Nine coefficients ring a little around bright spots, that must not turn into negative light
+		return ColorPacket{ Max(irradiance.r, 0.f), Max(irradiance.g, 0.f), Max(irradiance.b, 0.f) };
+	}
+
+	ImageBasedLighting::BilinearTaps ImageBasedLighting::GetBilinearTaps(const FloatPacket& offset, const FloatPacket& size, const FloatPacket& x, const FloatPacket& y)
+	{
+		//Clamping first also keeps lanes outside the pixel mask, which may hold anything, inside the tables
+		const FloatPacket maxTexel{ size - 1.f };
+		const FloatPacket clampedX{ Min(Max(x, 0.f), maxTexel) };
+		const FloatPacket clampedY{ Min(Max(y, 0.f), maxTexel) };
+		const FloatPacket x0{ Truncate(clampedX) };
+		const FloatPacket y0{ Truncate(clampedY) };
+		const FloatPacket x1{ Min(x0 + 1.f, maxTexel) };
+		const FloatPacket y1{ Min(y0 + 1.f, maxTexel) };
+		const FloatPacket fractionX{ clampedX - x0 };
+		const FloatPacket fractionY{ clampedY - y0 };
+		const FloatPacket row0{ offset + y0 * size };
+		const FloatPacket row1{ offset + y1 * size };
+
+		BilinearTaps taps{};
+		taps.indices[0] = row0 + x0;
+		taps.indices[1] = row0 + x1;
+		taps.indices[2] = row1 + x0;
+		taps.indices[3] = row1 + x1;
+		taps.weights[0] = (FloatPacket{ 1.f } - fractionX) * (FloatPacket{ 1.f } - fractionY);
+		taps.weights[1] = fractionX * (FloatPacket{ 1.f } - fractionY);
+		taps.weights[2] = (FloatPacket{ 1.f } - fractionX) * fractionY;
+		taps.weights[3] = fractionX * fractionY;
+		return taps;
+	}
+
+	FloatPacket ImageBasedLighting::SampleBilinear(const float* pTexels, const BilinearTaps& taps)
+	{
+		FloatPacket value{};
+		for (int tapIdx{}; tapIdx < 4; ++tapIdx) value += FloatPacket::Gather(pTexels, taps.indices[tapIdx]) * taps.weights[tapIdx];
+		return value;
+	}
+}
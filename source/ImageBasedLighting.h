@@ -0,0 +1,59 @@
+#pragma once
+#include <functional>
+#include <vector>
+
+#include "FloatPacket.h"
+
+namespace dae
+{
+	//Tables for the split sum approximation of a GGX surface lit by its environment
+	//Everything is integrated once up front, shading a pixel only looks the results up
+	class ImageBasedLighting final
+	{
+	public:
+		//Entries per axis of the BRDF table, the cosine between normal and view against roughness
+		static constexpr int BRDFTableSize{ 32 };
+		//The environment is octahedral encoded, the first level is a mirror and every further level is rougher
+		static constexpr int EnvironmentSize{ 128 };
+		static constexpr int NumRoughnessLevels{ 6 };
+
+		//Radiance arriving from a normalized world space direction, only called while building
+		void Build(const std::function<ColorRGB(const Vector3&)>& radiance);
+
+		//Scale and bias to apply to F0, the BRDF integrated over the hemisphere for that view angle and roughness
+		void SampleBRDF(const FloatPacket& nDotV, const FloatPacket& roughness, FloatPacket& scale, FloatPacket& bias) const;
+		//Environment radiance convolved with the GGX lobe of the roughness around a normalized direction
+		ColorPacket SampleSpecular(const Vector3Packet& direction, const FloatPacket& roughness) const;
+		//Cosine weighted irradiance around the normal, evaluated from nine spherical harmonics coefficients
+		ColorPacket SampleIrradiance(const Vector3Packet& normal) const;
+
+	private:
+		std::vector<float> m_BRDFScale{};
+		std::vector<float> m_BRDFBias{};
+
+		//All levels one after the other, a channel per array so packets can gather them
+		std::vector<float> m_EnvironmentRed{};
+		std::vector<float> m_EnvironmentGreen{};
+		std::vector<float> m_EnvironmentBlue{};
+		//Texels per side and first texel of every level, as floats for the gathers
+		float m_LevelSizes[NumRoughnessLevels]{};
+		float m_LevelOffsets[NumRoughnessLevels]{};
+
+		//Already multiplied by the cosine lobe, band by band
+		ColorRGB m_IrradianceCoefficients[9]{};
+
+		void BuildBRDFTable();
+		void BuildEnvironment(const std::function<ColorRGB(const Vector3&)>& radiance);
+		void BuildIrradiance(const std::function<ColorRGB(const Vector3&)>& radiance);
+
+		//Four texels and their weights, shared by every channel that is looked up at the same spot
+		struct BilinearTaps
+		{
+			FloatPacket indices[4]{};
+			FloatPacket weights[4]{};
+		};
+		//x and y are in texels of a square of the given size starting at offset, the edges are clamped
+		static BilinearTaps GetBilinearTaps(const FloatPacket& offset, const FloatPacket& size, const FloatPacket& x, const FloatPacket& y);
+		static FloatPacket SampleBilinear(const float* pTexels, const BilinearTaps& taps);
+	};
+}
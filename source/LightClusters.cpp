@@ -0,0 +1,115 @@
+#include "LightClusters.h"
+#include "Camera.h"
+#include "DataTypes.h"
+
+#include <algorithm>
+
+namespace dae
+{
+	void LightClusters::Build(std::span<const Light> lights, const Camera& camera, int width, int height)
+	{
+		m_TilesX = (width + TileSize - 1) / TileSize;
+		m_TilesY = (height + TileSize - 1) / TileSize;
+		m_NearPlane = camera.nearPlane;
+		m_SliceScale = NumDepthSlices / log2f(camera.farPlane / camera.nearPlane);
+
+		//Spheres around the lights projected to a conservative tile rectangle and slice range
+		//Spot lights use the sphere of their range as well, it is loose but never misses a pixel
+		m_LightBounds.clear();
+		m_LightBounds.reserve(lights.size());
+		const float projectionX{ 1.f / (camera.fov * camera.aspectRatio) };
+		const float projectionY{ 1.f / camera.fov };
+		for (const Light& light : lights)
+		{
+			const Vector3 center{ camera.viewMatrix.TransformPoint(light.position) };
+			const float nearDepth{ center.z - light.range };
+			const float farDepth{ center.z + light.range };
+			if (farDepth < camera.nearPlane || nearDepth > camera.farPlane)
+			{
+				m_LightBounds.push_back(LightBounds{ 0, -1, 0, -1, 0, -1 });
+				continue;
+			}
+
+			LightBounds bounds{ 0, m_TilesX - 1, 0, m_TilesY - 1, GetDepthSlice(nearDepth), GetDepthSlice(farDepth) };
+			//A sphere that reaches behind the near plane can cover any part of the screen
+			if (nearDepth > camera.nearPlane)
+			{
+				//Dividing by the nearest depth widens an extent that points away from the center of the screen, the farthest widens the others
+				const auto project{ [&](float extent, float projection)
+					{
+						return extent * projection / (extent < 0.f ? nearDepth : farDepth);
+					}
+				};
+				const auto projectMax{ [&](float extent, float projection)
+					{
+						return extent * projection / (extent > 0.f ? nearDepth : farDepth);
+					}
+				};
+				const float minNdcX{ project(center.x - light.range, projectionX) };
+				const float maxNdcX{ projectMax(center.x + light.range, projectionX) };
+				const float minNdcY{ project(center.y - light.range, projectionY) };
+				const float maxNdcY{ projectMax(center.y + light.range, projectionY) };
+
+				//Same mapping as the screen space vertices, y points down on screen
+				const auto toTile{ [](float ndc, float size, int numTiles)
+					{
+						const float pixel{ (ndc + 1.f) * 0.5f * size };
+						return std::clamp(static_cast<int>(pixel) / TileSize, 0, numTiles - 1);
+					}
+				};
+				bounds.minX = toTile(minNdcX, static_cast<float>(width), m_TilesX);
+				bounds.maxX = toTile(maxNdcX, static_cast<float>(width), m_TilesX);
+				bounds.minY = toTile(-maxNdcY, static_cast<float>(height), m_TilesY);
+				bounds.maxY = toTile(-minNdcY, static_cast<float>(height), m_TilesY);
+				if (maxNdcX < -1.f || minNdcX > 1.f || maxNdcY < -1.f || minNdcY > 1.f) bounds.maxX = -1;
+			}
+			m_LightBounds.push_back(bounds);
+		}
+
+		//Counting sort, the first pass counts the lights per cluster and the second drops them into place
+		const size_t numClusters{ static_cast<size_t>(m_TilesX) * m_TilesY * NumDepthSlices };
+		m_ClusterOffsets.assign(numClusters + 1, 0);
+		const auto forEachCluster{ [&](const LightBounds& bounds, const auto& function)
+			{
+				for (int slice{ bounds.minSlice }; slice <= bounds.maxSlice; ++slice)
+				{
+					for (int tileY{ bounds.minY }; tileY <= bounds.maxY; ++tileY)
+					{
+						for (int tileX{ bounds.minX }; tileX <= bounds.maxX; ++tileX)
+						{
+							function((slice * m_TilesY + tileY) * m_TilesX + tileX);
+						}
+					}
+				}
+			}
+		};
+		for (const LightBounds& bounds : m_LightBounds)
+		{
+			forEachCluster(bounds, [&](int clusterIdx) { ++m_ClusterOffsets[clusterIdx + 1]; });
+		}
+		for (size_t clusterIdx{}; clusterIdx < numClusters; ++clusterIdx)
+		{
+			m_ClusterOffsets[clusterIdx + 1] += m_ClusterOffsets[clusterIdx];
+		}
+
+		m_LightIndices.resize(m_ClusterOffsets[numClusters]);
+		std::vector<uint32_t> cursors(m_ClusterOffsets.begin(), m_ClusterOffsets.end() - 1);
+		for (uint32_t lightIdx{}; lightIdx < static_cast<uint32_t>(m_LightBounds.size()); ++lightIdx)
+		{
+			forEachCluster(m_LightBounds[lightIdx], [&](int clusterIdx) { m_LightIndices[cursors[clusterIdx]++] = lightIdx; });
+		}
+	}
+
+	uint32_t LightClusters::GetClusterIndex(int x, int y, float viewDepth) const
+	{
+		const int tileX{ std::min(x / TileSize, m_TilesX - 1) };
+		const int tileY{ std::min(y / TileSize, m_TilesY - 1) };
+		return static_cast<uint32_t>((GetDepthSlice(viewDepth) * m_TilesY + tileY) * m_TilesX + tileX);
+	}
+
+	int LightClusters::GetDepthSlice(float viewDepth) const
+	{
+		const float slice{ log2f(std::max(viewDepth, m_NearPlane) / m_NearPlane) * m_SliceScale };
+		return std::min(static_cast<int>(slice), NumDepthSlices - 1);
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace dae
+{
+	struct Camera;
+	struct Light;
+
+	//Screen tiles times exponential depth slices, every cluster lists the lights whose range reaches into it
+	//Rebuilt every frame, a pixel then only evaluates the lights of its own cluster
+	class LightClusters final
+	{
+	public:
+		static constexpr int TileSize{ 32 };
+		static constexpr int NumDepthSlices{ 16 };
+
+		//Light positions are in world space, the camera's view matrix has to be up to date
+		void Build(std::span<const Light> lights, const Camera& camera, int width, int height);
+
+		//Pixel coordinates and the view space depth of the pixel, which is the w of its clip position
+		uint32_t GetClusterIndex(int x, int y, float viewDepth) const;
+		std::span<const uint32_t> GetLights(uint32_t clusterIdx) const
+		{
+			return { m_LightIndices.data() + m_ClusterOffsets[clusterIdx], m_ClusterOffsets[clusterIdx + 1] - m_ClusterOffsets[clusterIdx] };
+		}
+
+	private:
+		//Inclusive cluster range a light touches
+		struct LightBounds
+		{
+			int minX{};
+			int maxX{};
+			int minY{};
+			int maxY{};
+			int minSlice{};
+			int maxSlice{};
+		};
+
+		int m_TilesX{};
+		int m_TilesY{};
+		float m_NearPlane{ 1.f };
+		//Slice of a depth is log2(depth / near) * m_SliceScale
+		float m_SliceScale{};
+
+		//Offsets into m_LightIndices, one past the last cluster holds the total
+		std::vector<uint32_t> m_ClusterOffsets{ 0 };
+		std::vector<uint32_t> m_LightIndices{};
+		std::vector<LightBounds> m_LightBounds{};
+
+		int GetDepthSlice(float viewDepth) const;
+	};
+}
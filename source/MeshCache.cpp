@@ -0,0 +1,229 @@
+#include "MeshCache.h"
+#include "DataTypes.h"
+#include "MappedFile.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+namespace dae
+{
+	namespace MeshCache
+	{
+		constexpr uint32_t Magic{ 0x48534D44 }; //"DMSH"
+		constexpr uint32_t Version{ 8 };
+		constexpr uint64_t SectionAlignment{ 64 };
+
+		enum class SectionType : uint32_t
+		{
+			Vertices,
+			Indices,
+			Meshlets,
+			PackedVertices
+		};
+
+		struct Header
+		{
+			uint32_t magic{ Magic };
+			uint32_t version{ Version };
+			uint32_t primitiveTopology{};
+			uint32_t numSections{};
+			uint64_t sourceSize{};
+			int64_t sourceTimestamp{};
+			uint64_t sourceHash{};
+			float boundsMin[3]{};
+			float boundsMax[3]{};
+			float uvMin[2]{};
+			float uvMax[2]{};
+		};
+
+		//Unknown section types are skipped, so later versions can append data without breaking old readers
+		struct SectionDesc
+		{
+			SectionType type{};
+			uint32_t stride{};
+			uint64_t offset{};
+			uint64_t count{};
+		};
+
+		//Restart indices only mean something to strips, lists would read them as vertices
+		template<typename IndexType>
+		static bool AreIndicesValid(std::span<const IndexType> indices, size_t numVertices, bool allowRestart)
+		{
+			return std::all_of(indices.begin(), indices.end(), [numVertices, allowRestart](IndexType index)
+				{
+					return index < numVertices || (allowRestart && index == PrimitiveRestartIndex<IndexType>);
+				}
+			);
+		}
+
+		std::string GetCachePath(const std::string& sourcePath)
+		{
+			return sourcePath + ".mcache";
+		}
+
+		bool Load(const std::string& cachePath, const std::string& sourcePath, Mesh& mesh)
+		{
+			const std::shared_ptr<MappedFile> pFile{ MappedFile::Open(cachePath) };
+			if (!pFile || pFile->GetSize() < sizeof(Header)) return false;
+
+			Header header{};
+			std::memcpy(&header, pFile->GetData(), sizeof(Header));
+			if (header.magic != Magic || header.version != Version) return false;
+			if (header.primitiveTopology > static_cast<uint32_t>(PrimitiveTopology::TriangleStrip)) return false;
+			if ((pFile->GetSize() - sizeof(Header)) / sizeof(SectionDesc) < header.numSections) return false;
+
+			if (header.sourceSize != FileUtils::GetFileSize(sourcePath)) return false;
+			if (header.sourceTimestamp != FileUtils::GetTimestamp(sourcePath) && header.sourceHash != FileUtils::HashFile(sourcePath)) return false;
+
+			std::span<const Vertex> vertices{};
+			std::span<const PackedVertex> packedVertices{};
+			std::span<const uint16_t> indices16{};
+			std::span<const uint32_t> indices32{};
+			std::span<const Meshlet> meshlets{};
+			for (uint32_t sectionIdx{}; sectionIdx < header.numSections; ++sectionIdx)
+			{
+				SectionDesc section{};
+				std::memcpy(&section, pFile->GetData() + sizeof(Header) + sectionIdx * sizeof(SectionDesc), sizeof(SectionDesc));
+				if (section.stride == 0 || section.count > pFile->GetSize() / section.stride) return false;
+				const uint64_t sectionSize{ section.count * section.stride };
+				if (section.offset > pFile->GetSize() - sectionSize) return false;
+
+				const uint8_t* pSectionData{ pFile->GetData() + section.offset };
+				switch (section.type)
+				{
+				case SectionType::Vertices:
+					//A different Vertex layout means the cache was written by another build
+					if (section.stride != sizeof(Vertex)) return false;
+					vertices = { reinterpret_cast<const Vertex*>(pSectionData), section.count };
+					break;
+				case SectionType::PackedVertices:
+					if (section.stride != sizeof(PackedVertex)) return false;
+					packedVertices = { reinterpret_cast<const PackedVertex*>(pSectionData), section.count };
+					break;
+				case SectionType::Indices:
+					//The stride tells the index format apart
+					if (section.stride == sizeof(uint16_t)) indices16 = { reinterpret_cast<const uint16_t*>(pSectionData), section.count };
+					else if (section.stride == sizeof(uint32_t)) indices32 = { reinterpret_cast<const uint32_t*>(pSectionData), section.count };
+					else return false;
+					break;
+				case SectionType::Meshlets:
+					if (section.stride != sizeof(Meshlet)) return false;
+					meshlets = { reinterpret_cast<const Meshlet*>(pSectionData), section.count };
+					break;
+				default:
+					break;
+				}
+			}
+
+			//A cache without vertices or indices would otherwise load as an empty but valid mesh
+			if (vertices.empty() && packedVertices.empty()) return false;
+			if (indices16.empty() && indices32.empty()) return false;
+
+			//Passing the source check does not make the contents intact, every index and meshlet has to stay inside the mesh
+			const size_t numVertices{ packedVertices.empty() ? vertices.size() : packedVertices.size() };
+			const size_t numIndices{ indices16.empty() ? indices32.size() : indices16.size() };
+			const bool isStrip{ static_cast<PrimitiveTopology>(header.primitiveTopology) == PrimitiveTopology::TriangleStrip };
+			if (!indices16.empty() && !AreIndicesValid(indices16, numVertices, isStrip)) return false;
+			if (indices16.empty() && !AreIndicesValid(indices32, numVertices, isStrip)) return false;
+			for (const Meshlet& meshlet : meshlets)
+			{
+				if (meshlet.numIndices > numIndices || meshlet.firstIndex > numIndices - meshlet.numIndices) return false;
+			}
+
+			mesh.vertexFormat = packedVertices.empty() ? VertexFormat::Float : VertexFormat::Packed;
+			mesh.vertices = vertices;
+			mesh.packedVertices = packedVertices;
+			mesh.indexFormat = indices16.empty() ? IndexFormat::UInt32 : IndexFormat::UInt16;
+			mesh.indices16 = indices16;
+			mesh.indices32 = indices32;
+			mesh.meshlets = meshlets;
+			mesh.primitiveTopology = static_cast<PrimitiveTopology>(header.primitiveTopology);
+			mesh.boundsMin = Vector3{ header.boundsMin[0], header.boundsMin[1], header.boundsMin[2] };
+			mesh.boundsMax = Vector3{ header.boundsMax[0], header.boundsMax[1], header.boundsMax[2] };
+			mesh.uvMin = Vector2{ header.uvMin[0], header.uvMin[1] };
+			mesh.uvMax = Vector2{ header.uvMax[0], header.uvMax[1] };
+			mesh.pGeometry = pFile;
+			return true;
+		}
+
+		bool LoadBounds(const std::string& cachePath, const std::string& sourcePath, Vector3& boundsMin, Vector3& boundsMax)
+		{
+			std::ifstream file{ cachePath, std::ios::binary };
+			if (!file) return false;
+
+			Header header{};
+			if (!file.read(reinterpret_cast<char*>(&header), sizeof(Header))) return false;
+			if (header.magic != Magic || header.version != Version) return false;
+			if (header.sourceSize != FileUtils::GetFileSize(sourcePath)) return false;
+
+			boundsMin = Vector3{ header.boundsMin[0], header.boundsMin[1], header.boundsMin[2] };
+			boundsMax = Vector3{ header.boundsMax[0], header.boundsMax[1], header.boundsMax[2] };
+			return true;
+		}
+
+		bool Write(const Mesh& mesh, const std::string& cachePath, const std::string& sourcePath)
+		{
+			Header header{};
+			header.primitiveTopology = static_cast<uint32_t>(mesh.primitiveTopology);
+			header.sourceSize = FileUtils::GetFileSize(sourcePath);
+			header.sourceTimestamp = FileUtils::GetTimestamp(sourcePath);
+			header.sourceHash = FileUtils::HashFile(sourcePath);
+			header.boundsMin[0] = mesh.boundsMin.x;
+			header.boundsMin[1] = mesh.boundsMin.y;
+			header.boundsMin[2] = mesh.boundsMin.z;
+			header.boundsMax[0] = mesh.boundsMax.x;
+			header.boundsMax[1] = mesh.boundsMax.y;
+			header.boundsMax[2] = mesh.boundsMax.z;
+			header.uvMin[0] = mesh.uvMin.x;
+			header.uvMin[1] = mesh.uvMin.y;
+			header.uvMax[0] = mesh.uvMax.x;
+			header.uvMax[1] = mesh.uvMax.y;
+
+			std::vector<SectionDesc> sections
+			{
+				mesh.vertexFormat == VertexFormat::Packed
+					? SectionDesc{ SectionType::PackedVertices, sizeof(PackedVertex), 0, mesh.packedVertices.size() }
+					: SectionDesc{ SectionType::Vertices, sizeof(Vertex), 0, mesh.vertices.size() },
+				SectionDesc{ SectionType::Indices, static_cast<uint32_t>(mesh.indexFormat == IndexFormat::UInt16 ? sizeof(uint16_t) : sizeof(uint32_t)), 0, mesh.GetNumIndices() },
+				SectionDesc{ SectionType::Meshlets, sizeof(Meshlet), 0, mesh.meshlets.size() }
+			};
+			const void* pIndices{ mesh.indexFormat == IndexFormat::UInt16 ? static_cast<const void*>(mesh.indices16.data()) : mesh.indices32.data() };
+			const void* pVertices{ mesh.vertexFormat == VertexFormat::Packed ? static_cast<const void*>(mesh.packedVertices.data()) : mesh.vertices.data() };
+			const void* sectionData[]{ pVertices, pIndices, mesh.meshlets.data() };
+			header.numSections = static_cast<uint32_t>(sections.size());
+
+			uint64_t offset{ sizeof(Header) + sections.size() * sizeof(SectionDesc) };
+			for (SectionDesc& section : sections)
+			{
+				offset = (offset + SectionAlignment - 1) & ~(SectionAlignment - 1);
+				section.offset = offset;
+				offset += section.count * section.stride;
+			}
+
+			//Write to a temporary file first so another process never maps a half written cache
+			const std::string tempPath{ cachePath + ".tmp" };
+			{
+				std::ofstream file{ tempPath, std::ios::binary };
+				if (!file) return false;
+
+				file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+				file.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(SectionDesc));
+				uint64_t writtenBytes{ sizeof(Header) + sections.size() * sizeof(SectionDesc) };
+				for (size_t sectionIdx{}; sectionIdx < sections.size(); ++sectionIdx)
+				{
+					const char padding[SectionAlignment]{};
+					file.write(padding, sections[sectionIdx].offset - writtenBytes);
+					file.write(static_cast<const char*>(sectionData[sectionIdx]), sections[sectionIdx].count * sections[sectionIdx].stride);
+					writtenBytes = sections[sectionIdx].offset + sections[sectionIdx].count * sections[sectionIdx].stride;
+				}
+				if (!file) return false;
+			}
+
+			std::error_code error{};
+			std::filesystem::rename(tempPath, cachePath, error);
+			return !error;
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+
+namespace dae
+{
+	struct Mesh;
+	struct Vector3;
+
+	//Versioned binary mesh format, loaded by mapping the file so the mesh views point straight into the page cache
+	namespace MeshCache
+	{
+		std::string GetCachePath(const std::string& sourcePath);
+
+		//Fails when the cache is missing, from another version or older than the source
+		bool Load(const std::string& cachePath, const std::string& sourcePath, Mesh& mesh);
+		//Reads only the header, cheap enough to size a placeholder before the mesh itself is loaded
+		bool LoadBounds(const std::string& cachePath, const std::string& sourcePath, Vector3& boundsMin, Vector3& boundsMax);
+		bool Write(const Mesh& mesh, const std::string& cachePath, const std::string& sourcePath);
+	}
+}
@@ -0,0 +1,154 @@
+#include "MeshletBuilder.h"
+#include "DataTypes.h"
+
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+
+namespace dae
+{
+	namespace MeshletBuilder
+	{
+		//Triangles bending more than about 45 degrees away from the cluster start a new one, keeping the normal cones narrow
+		constexpr float MinNormalAlignment{ 0.7f };
+
+		static Meshlet CreateMeshlet(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t firstIndex, uint32_t numIndices,
+			const std::vector<Vector3>& triangleNormals)
+		{
+			Meshlet meshlet{};
+			meshlet.firstIndex = firstIndex;
+			meshlet.numIndices = numIndices;
+
+			//Sphere around the center of the bounding box, not minimal but cheap and close for compact clusters
+			Vector3 boundsMin{ vertices[indices[firstIndex]].position };
+			Vector3 boundsMax{ boundsMin };
+			for (uint32_t idx{ firstIndex }; idx < firstIndex + numIndices; ++idx)
+			{
+				const Vector3& position{ vertices[indices[idx]].position };
+				boundsMin = Vector3{ std::min(boundsMin.x, position.x), std::min(boundsMin.y, position.y), std::min(boundsMin.z, position.z) };
+				boundsMax = Vector3{ std::max(boundsMax.x, position.x), std::max(boundsMax.y, position.y), std::max(boundsMax.z, position.z) };
+			}
+			meshlet.center = (boundsMin + boundsMax) * 0.5f;
+			for (uint32_t idx{ firstIndex }; idx < firstIndex + numIndices; ++idx)
+			{
+				meshlet.radius = std::max(meshlet.radius, (vertices[indices[idx]].position - meshlet.center).Magnitude());
+			}
+
+			Vector3 axis{};
+			for (uint32_t triIdx{ firstIndex / 3 }; triIdx < (firstIndex + numIndices) / 3; ++triIdx)
+			{
+				axis += triangleNormals[triIdx];
+			}
+			if (axis.Normalize() <= 0.f) return meshlet;
+
+			float minAlignment{ 1.f };
+			for (uint32_t triIdx{ firstIndex / 3 }; triIdx < (firstIndex + numIndices) / 3; ++triIdx)
+			{
+				//Degenerate triangles are never rasterized, they do not widen the cone
+				if (triangleNormals[triIdx].SqrMagnitude() <= 0.f) continue;
+				minAlignment = std::min(minAlignment, Vector3::Dot(axis, triangleNormals[triIdx]));
+			}
+
+			//Close to a half sphere the cone test would hardly ever pass, leave the cutoff at 1 so it is skipped
+			if (minAlignment <= 0.1f) return meshlet;
+			meshlet.coneAxis = axis;
+			meshlet.coneCutoff = sqrtf(1.f - minAlignment * minAlignment);
+			return meshlet;
+		}
+
+		std::vector<Meshlet> Build(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+		{
+			const uint32_t numTriangles{ static_cast<uint32_t>(indices.size() / 3) };
+			const uint32_t numVertices{ static_cast<uint32_t>(vertices.size()) };
+
+			//Face normals follow the winding, which is what decides if the rasterizer draws a triangle
+			std::vector<Vector3> triangleNormals(numTriangles);
+			for (uint32_t triIdx{}; triIdx < numTriangles; ++triIdx)
+			{
+				const Vector3& v0{ vertices[indices[triIdx * 3]].position };
+				const Vector3& v1{ vertices[indices[triIdx * 3 + 1]].position };
+				const Vector3& v2{ vertices[indices[triIdx * 3 + 2]].position };
+				Vector3 normal{ Vector3::Cross(v1 - v0, v2 - v0) };
+				if (normal.Normalize() <= 0.f) normal = Vector3{};
+				triangleNormals[triIdx] = normal;
+			}
+
+			//OBJ faces often get their own copies of shared corners (other uv or normal), so connectivity goes through welded positions
+			std::vector<uint32_t> positionIds(numVertices);
+			uint32_t numPositions{};
+			{
+				std::unordered_map<std::string_view, uint32_t> positionLookup{};
+				positionLookup.reserve(numVertices);
+				for (uint32_t vertIdx{}; vertIdx < numVertices; ++vertIdx)
+				{
+					const std::string_view key{ reinterpret_cast<const char*>(&vertices[vertIdx].position), sizeof(Vector3) };
+					positionIds[vertIdx] = positionLookup.try_emplace(key, numPositions).first->second;
+					if (positionIds[vertIdx] == numPositions) ++numPositions;
+				}
+			}
+
+			//Position to triangle adjacency in compressed rows
+			std::vector<uint32_t> adjacencyOffsets(numPositions + 1);
+			for (uint32_t idx{}; idx < numTriangles * 3; ++idx) ++adjacencyOffsets[positionIds[indices[idx]] + 1];
+			for (uint32_t positionIdx{}; positionIdx < numPositions; ++positionIdx) adjacencyOffsets[positionIdx + 1] += adjacencyOffsets[positionIdx];
+			std::vector<uint32_t> adjacentTriangles(numTriangles * 3);
+			{
+				std::vector<uint32_t> fillOffsets{ adjacencyOffsets.begin(), adjacencyOffsets.end() - 1 };
+				for (uint32_t idx{}; idx < numTriangles * 3; ++idx)
+				{
+					adjacentTriangles[fillOffsets[positionIds[indices[idx]]]++] = idx / 3;
+				}
+			}
+
+			//Grow every cluster breadth first from a seed, so it stays spatially compact
+			std::vector<uint32_t> reorderedIndices{};
+			reorderedIndices.reserve(numTriangles * 3);
+			std::vector<Vector3> reorderedNormals{};
+			reorderedNormals.reserve(numTriangles);
+			std::vector<bool> isAssigned(numTriangles);
+			std::vector<uint32_t> frontier{};
+			std::vector<Meshlet> meshlets{};
+			for (uint32_t seedIdx{}; seedIdx < numTriangles; ++seedIdx)
+			{
+				if (isAssigned[seedIdx]) continue;
+
+				const uint32_t firstIndex{ static_cast<uint32_t>(reorderedIndices.size()) };
+				uint32_t numClusterTriangles{};
+				Vector3 clusterNormal{};
+				frontier.clear();
+				frontier.push_back(seedIdx);
+				for (size_t frontierIdx{}; frontierIdx < frontier.size() && numClusterTriangles < MaxTriangles; ++frontierIdx)
+				{
+					const uint32_t triIdx{ frontier[frontierIdx] };
+					if (isAssigned[triIdx]) continue;
+					if (numClusterTriangles > 0 && Vector3::Dot(triangleNormals[triIdx], clusterNormal.Normalized()) < MinNormalAlignment
+						&& triangleNormals[triIdx].SqrMagnitude() > 0.f)
+					{
+						continue;
+					}
+
+					isAssigned[triIdx] = true;
+					++numClusterTriangles;
+					clusterNormal += triangleNormals[triIdx];
+					reorderedIndices.insert(reorderedIndices.end(), indices.begin() + triIdx * 3, indices.begin() + triIdx * 3 + 3);
+					reorderedNormals.push_back(triangleNormals[triIdx]);
+
+					for (uint32_t cornerIdx{}; cornerIdx < 3; ++cornerIdx)
+					{
+						const uint32_t positionIdx{ positionIds[indices[triIdx * 3 + cornerIdx]] };
+						for (uint32_t adjacencyIdx{ adjacencyOffsets[positionIdx] }; adjacencyIdx < adjacencyOffsets[positionIdx + 1]; ++adjacencyIdx)
+						{
+							if (!isAssigned[adjacentTriangles[adjacencyIdx]]) frontier.push_back(adjacentTriangles[adjacencyIdx]);
+						}
+					}
+				}
+
+				const uint32_t numIndices{ static_cast<uint32_t>(reorderedIndices.size()) - firstIndex };
+				meshlets.push_back(CreateMeshlet(vertices, reorderedIndices, firstIndex, numIndices, reorderedNormals));
+			}
+
+			indices.swap(reorderedIndices);
+			return meshlets;
+		}
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace dae
+{
+	struct Vertex;
+	struct Meshlet;
+
+	namespace MeshletBuilder
+	{
+		//Triangles per cluster, small enough to cull tightly and large enough to amortize the test
+		constexpr uint32_t MaxTriangles{ 128 };
+
+		//Groups the triangle list into clusters of connected, similarly facing triangles
+		//The index buffer is reordered so every meshlet covers a contiguous index range
+		std::vector<Meshlet> Build(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	}
+}
@@ -6,8 +6,13 @@
 #include "Renderer.h"
 #include "Math.h"
 #include "Matrix.h"
+#include "MeshCache.h"
 #include "Texture.h"
 #include "Utils.h"
+#include "VirtualTexture.h"
+#include "DepthRasterizer.h"
+#include <array>
+#include <bit>
 
 //Multithreading includes
 #include <thread>
@@ -20,10 +25,6 @@ using namespace dae;
 
 Renderer::Renderer(SDL_Window* pWindow) 
 	: m_pWindow(pWindow)
-	, m_pDiffuseTexture{Texture::LoadFromFile("Resources/vehicle_diffuse.png") }
-	, m_pNormalTexture{Texture::LoadFromFile("Resources/Vehicle_normal.png")}
-	, m_pGlossinessTexture{Texture::LoadFromFile("Resources/Vehicle_gloss.png")}
-	, m_pSpecularTexture{Texture::LoadFromFile("Resources/Vehicle_specular.png")}
 {
 	//Initialize
 	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
@@ -41,28 +42,81 @@ Renderer::Renderer(SDL_Window* pWindow)
 
 	//Initialize Camera
 	m_Camera.Initialize(60.f, { 0.f,0.f, 0.f }, m_AspectRatio);
-	Mesh mesh{ {},{}, PrimitiveTopology::TriangleList};
-	Utils::ParseOBJ("Resources/vehicle.obj", mesh.vertices, mesh.indices);
-	mesh.worldMatrix = Matrix::CreateTranslation(0.f, 0.f, 50.f) * mesh.worldMatrix;
-	m_Meshes.push_back(mesh);
+
+	//Load Assets
+	//Block compressed maps use 4 to 8 times less memory than the decoded surfaces
+	m_ColorFormat = m_UseCompressedTextures ? TextureFormat::BC1 : TextureFormat::RGBA8;
+	m_GlossFormat = m_UseCompressedTextures ? TextureFormat::BC4 : TextureFormat::RGBA8;
+	m_NormalFormat = m_UseCompressedTextures ? TextureFormat::BC5 : TextureFormat::NormalSNORM8;
+	m_AssetManager.RequestTexture("Resources/vehicle_diffuse.png", m_ColorFormat);
+	m_AssetManager.RequestTexture("Resources/vehicle_normal.png", m_NormalFormat);
+	m_AssetManager.RequestTexture("Resources/vehicle_gloss.png", m_GlossFormat);
+	m_AssetManager.RequestTexture("Resources/vehicle_specular.png", m_ColorFormat);
+	m_AssetManager.RequestMesh("Resources/vehicle.obj");
+	//Loading happens in the background, the first frames render placeholders and the scene fills in as assets arrive
+	m_AssetManager.LoadRequestedAsync();
+
+	if (m_UseVirtualTexturing)
+	{
+		m_pVirtualDiffuseTexture = VirtualTexture::LoadFromFile("Resources/vehicle_diffuse.png");
+	}
+
+	AddStreamingMesh("Resources/vehicle.obj", Matrix::CreateTranslation(0.f, 0.f, 50.f));
+
+	if (m_UseLocalLights)
+	{
+		//Local lights, a ring of small colored point lights around the vehicle and a spot light from above
+		constexpr int numRingLights{ 128 };
+		m_Lights.reserve(numRingLights + 1);
+		for (int lightIdx{}; lightIdx < numRingLights; ++lightIdx)
+		{
+			const float angle{ lightIdx * 2.f * PI / numRingLights };
+			Light light{};
+			light.position = Vector3{ cosf(angle) * 26.f, 4.f * sinf(3.f * angle), 50.f + sinf(angle) * 22.f };
+			light.color = ColorRGB{ 0.5f + 0.5f * cosf(angle), 0.5f + 0.5f * cosf(angle + 2.f * PI / 3.f), 0.5f + 0.5f * cosf(angle + 4.f * PI / 3.f) };
+			light.intensity = 40.f;
+			light.range = 9.f;
+			m_Lights.push_back(light);
+		}
+
+		Light spotLight{};
+		spotLight.type = LightType::Spot;
+		spotLight.position = Vector3{ 0.f, 30.f, 30.f };
+		spotLight.direction = (Vector3{ 0.f, 0.f, 50.f } - spotLight.position).Normalized();
+		spotLight.color = ColorRGB{ 1.f, 0.9f, 0.7f };
+		spotLight.intensity = 600.f;
+		spotLight.range = 70.f;
+		spotLight.cosInnerAngle = cosf(15.f * TO_RADIANS);
+		spotLight.cosOuterAngle = cosf(25.f * TO_RADIANS);
+		m_Lights.push_back(spotLight);
+	}
+
+	//Environment of the PBR mode, a sky that fades to a darker ground with a glow around the sun
+	const Vector3 toSun{ -m_LightDirection };
+	m_ImageBasedLighting.Build([toSun](const Vector3& direction)
+		{
+			const ColorRGB zenith{ 0.18f, 0.3f, 0.55f };
+			const ColorRGB horizon{ 0.5f, 0.52f, 0.55f };
+			const ColorRGB ground{ 0.12f, 0.1f, 0.08f };
+			const float height{ direction.y };
+			ColorRGB color{ height > 0.f ? ColorRGB::Lerp(horizon, zenith, sqrtf(height)) : ColorRGB::Lerp(horizon, ground, std::min(-height * 4.f, 1.f)) };
+			//The glow is kept wide, a sharp sun disk would alias in the prefiltered levels
+			const float sunAngle{ std::max(Vector3::Dot(direction, toSun), 0.f) };
+			const float sunGlow{ powf(sunAngle, 64.f) * 6.f + powf(sunAngle, 4.f) * 0.4f };
+			return color + ColorRGB{ 1.f, 0.9f, 0.75f } * sunGlow;
+		}
+	);
 }
 
 Renderer::~Renderer()
 {
 	delete[] m_pDepthBufferPixels;
 	m_pDepthBufferPixels = nullptr;
-	delete m_pDiffuseTexture;
-	m_pDiffuseTexture = nullptr;
-	delete m_pNormalTexture;
-	m_pNormalTexture = nullptr;
-	delete m_pSpecularTexture;
-	m_pDiffuseTexture = nullptr;
-	delete m_pGlossinessTexture;
-	m_pGlossinessTexture = nullptr;
 }
 
 void Renderer::Update(Timer* pTimer)
 {
+	UpdateStreaming();
 	m_Camera.Update(pTimer);
 	if (m_ShouldRotate)
 	{
@@ -76,15 +130,20 @@ void Renderer::Update(Timer* pTimer)
 void Renderer::Render()
 {
 	//@START
+	if (m_UseVariableRateShading) UpdateShadingRates();
 	//Lock BackBuffer
 	SDL_FillRect(m_pBackBuffer, NULL, SDL_MapRGB(m_pBackBuffer->format, 100, 100, 100));
 	const int nrPixels{ m_Width * m_Height };
 	std::fill_n(m_pDepthBufferPixels, nrPixels, 1.f);
 	SDL_LockSurface(m_pBackBuffer);
 	//RENDER LOGIC
+	if (!m_Lights.empty()) m_LightClusters.Build(m_Lights, m_Camera, m_Width, m_Height);
+	if (m_UseShadows) RenderShadowMap();
 	//Render_W1();
 	//Render_W2();
 	Render_W3();
+	//Stream in the pages the rasterizer asked for, they are used from the next frame on
+	if (m_pVirtualDiffuseTexture) m_pVirtualDiffuseTexture->Update();
 	//@END
 	//Update SDL Surface
 	SDL_UnlockSurface(m_pBackBuffer);
@@ -92,6 +151,48 @@ void Renderer::Render()
 	SDL_UpdateWindowSurface(m_pWindow);
 }
 
+void Renderer::AddStreamingMesh(const std::string& path, const Matrix& worldMatrix)
+{
+	//The mesh cache header already knows the bounds, without a cache the placeholder is a unit box
+	Vector3 boundsMin{ -1.f, -1.f, -1.f };
+	Vector3 boundsMax{ 1.f, 1.f, 1.f };
+	MeshCache::LoadBounds(MeshCache::GetCachePath(path), path, boundsMin, boundsMax);
+
+	Mesh placeholder{ Mesh::CreateBox(boundsMin, boundsMax) };
+	placeholder.worldMatrix = worldMatrix;
+	m_StreamingMeshes.push_back(StreamingMesh{ path, m_Meshes.size() });
+	m_Meshes.push_back(std::move(placeholder));
+}
+
+void Renderer::UpdateStreaming()
+{
+	//Runs between frames on the main thread, so the rasterizer never sees a scene that changes mid frame
+	if (!m_pDiffuseTexture) m_pDiffuseTexture = m_AssetManager.TryGetTexture("Resources/vehicle_diffuse.png", m_ColorFormat);
+	if (!m_pNormalTexture) m_pNormalTexture = m_AssetManager.TryGetTexture("Resources/vehicle_normal.png", m_NormalFormat);
+	if (!m_pGlossinessTexture) m_pGlossinessTexture = m_AssetManager.TryGetTexture("Resources/vehicle_gloss.png", m_GlossFormat);
+	if (!m_pSpecularTexture) m_pSpecularTexture = m_AssetManager.TryGetTexture("Resources/vehicle_specular.png", m_ColorFormat);
+
+	if (m_StreamingMeshes.empty()) return;
+
+	//Sampled before looking up the meshes, once it is false every mesh of the batch has been published
+	const bool isLoading{ m_AssetManager.IsLoading() };
+	std::erase_if(m_StreamingMeshes, [&](const StreamingMesh& streamingMesh)
+		{
+			if (const std::shared_ptr<Mesh> pMesh{ m_AssetManager.TryGetMesh(streamingMesh.path) })
+			{
+				//Keep the placeholder's transform, it may have been rotating for a while already
+				Mesh& mesh{ m_Meshes[streamingMesh.meshIdx] };
+				const Matrix worldMatrix{ mesh.worldMatrix };
+				mesh = *pMesh;
+				mesh.worldMatrix = worldMatrix;
+				return true;
+			}
+			//A mesh that failed to load keeps its placeholder
+			return !isLoading;
+		}
+	);
+}
+
 void Renderer::VertexTransformationFunction(const std::vector<Vertex>& vertices_in, std::vector<Vertex>& vertices_out) const
 {
 	vertices_out.reserve(vertices_in.size());
@@ -109,21 +210,42 @@ void Renderer::VertexTransformationFunction(const std::vector<Vertex>& vertices_
 void Renderer::VertexTransformationFunction(Mesh& mesh) const
 {
 	mesh.vertices_out.clear();
-	mesh.vertices_out.reserve(mesh.vertices.size());
-	const Matrix worldViewProjectionMatrix{ mesh.worldMatrix * m_Camera.viewMatrix * m_Camera.projectionMatrix };
+	mesh.vertices_out.reserve(mesh.GetNumVertices());
+
+	//Positions of packed meshes are dequantized by the matrices, the normals keep the plain world matrix
+	const Matrix positionMatrix{ mesh.vertexFormat == VertexFormat::Packed ? mesh.GetDequantizationMatrix() * mesh.worldMatrix : mesh.worldMatrix };
+	const Matrix worldViewProjectionMatrix{ positionMatrix * m_Camera.viewMatrix * m_Camera.projectionMatrix };
+	const auto transformVertex{ [&](const Vector3& position, const ColorRGB& color, const Vector2& uv, const Vector3& normal, const Vector3& tangent)
+		{
+			Vertex_Out vertexOut{ Vector4{ position, 1.f }, color, uv };
+			vertexOut.position = worldViewProjectionMatrix.TransformPoint(vertexOut.position);
+			const float perspectiveDiv{ 1.f / vertexOut.position.w };
+			vertexOut.position.x *= perspectiveDiv;
+			vertexOut.position.y *= perspectiveDiv;
+			vertexOut.position.z *= perspectiveDiv;
+			vertexOut.normal = mesh.worldMatrix.TransformVector(normal);
+			vertexOut.tangent = mesh.worldMatrix.TransformVector(tangent);
+			vertexOut.viewDirection = (positionMatrix.TransformPoint(position) - m_Camera.origin);
+			mesh.vertices_out.emplace_back(vertexOut);
+		}
+	};
+
+	if (mesh.vertexFormat == VertexFormat::Packed)
+	{
+		const Vector2 uvScale{ (mesh.uvMax - mesh.uvMin) / VertexQuantization::UnormScale };
+		for (const PackedVertex& vertexIn : mesh.packedVertices)
+		{
+			const Vector3 position{ static_cast<float>(vertexIn.position[0]), static_cast<float>(vertexIn.position[1]), static_cast<float>(vertexIn.position[2]) };
+			const Vector2 uv{ mesh.uvMin.x + vertexIn.uv[0] * uvScale.x, mesh.uvMin.y + vertexIn.uv[1] * uvScale.y };
+			transformVertex(position, colors::White, uv,
+				VertexQuantization::DecodeOctahedral(vertexIn.normal), VertexQuantization::DecodeOctahedral(vertexIn.tangent));
+		}
+		return;
+	}
+
 	for (const auto& vertexIn : mesh.vertices)
 	{
-		Vertex_Out vertexOut{ Vector4{ vertexIn.position, 1.f}, vertexIn.color, 
-			vertexIn.uv, vertexIn.normal, vertexIn.tangent, vertexIn.viewDirection};
-		vertexOut.position = worldViewProjectionMatrix.TransformPoint(vertexOut.position);
-		const float perspectiveDiv{ 1.f / vertexOut.position.w };
-		vertexOut.position.x *= perspectiveDiv;
-		vertexOut.position.y *= perspectiveDiv;
-		vertexOut.position.z *= perspectiveDiv;
-		vertexOut.normal = mesh.worldMatrix.TransformVector(vertexIn.normal);
-		vertexOut.tangent = mesh.worldMatrix.TransformVector(vertexIn.tangent);
-		vertexOut.viewDirection = (mesh.worldMatrix.TransformPoint(vertexIn.position) - m_Camera.origin);
-		mesh.vertices_out.emplace_back(vertexOut);
+		transformVertex(vertexIn.position, vertexIn.color, vertexIn.uv, vertexIn.normal, vertexIn.tangent);
 	}
 }
 
@@ -293,8 +415,8 @@ void dae::Renderer::Render_W3()
 {
 	std::vector<Mesh> meshesWorld
 			{
-				Mesh
-				{
+				Mesh::Create
+				(
 					{
 						Vertex{Vector3{-3.f, 3.f, -2.f}, colors::White, Vector2{0.f, 0.f}},
 						Vertex{Vector3{0.f, 3.f, -2.f}, colors::White, Vector2{0.5f, 0.f}},
@@ -308,7 +430,7 @@ void dae::Renderer::Render_W3()
 					},
 					{
 						3, 0, 4, 1, 5, 2,
-						2, 6,
+						PrimitiveRestartIndex<uint32_t>,
 						6, 3, 7, 4, 8, 5
 		
 						//TriangleList Indices
@@ -323,7 +445,7 @@ void dae::Renderer::Render_W3()
 		
 					},
 					PrimitiveTopology::TriangleStrip
-				}	
+				)	
 		
 			};
 	for (auto& mesh : m_Meshes)
@@ -342,162 +464,761 @@ void dae::Renderer::Render_W3()
 			);
 		}
 
-		switch (mesh.primitiveTopology)
+		//The primitive assembler is instantiated per index format and shader permutation, both are only looked at once per mesh
+		DispatchShaderPermutation([&]<typename Shader>(Shader)
+			{
+				if (mesh.indexFormat == IndexFormat::UInt16) RenderMesh<uint16_t, Shader>(mesh, screenVertices);
+				else RenderMesh<uint32_t, Shader>(mesh, screenVertices);
+			}
+		);
+	}
+}
+
+template<typename Draw>
+void dae::Renderer::DispatchShaderPermutation(const Draw& draw) const
+{
+	//The depth visualization ignores the shading state, it gets a single permutation
+	if (m_RenderMode == RenderMode::DepthBuffer)
+	{
+		draw(ShaderPermutation<RenderMode::DepthBuffer>{});
+		return;
+	}
+
+	//Maps that are still streaming in pick the permutation without them, the surface sharpens up once they arrive
+	const bool useNormalMap{ m_ShouldRenderNormals && m_pNormalTexture };
+	const bool useSpecularMaps{ m_pSpecularTexture && m_pGlossinessTexture };
+	const bool useLocalLights{ !m_Lights.empty() };
+	//Turns a runtime flag into a std::bool_constant, so it can become a template argument
+	const auto withFlag{ [](bool flag, const auto& next)
 		{
-		case PrimitiveTopology::TriangleStrip:
+			if (flag) next(std::true_type{});
+			else next(std::false_type{});
+		}
+	};
+	const auto dispatchMaps{ [&]<ShadingMode Shading>(bool normalMapping, bool specularMapping, bool fastSpecular, bool localLights, bool shadows)
 		{
-			const uint32_t numIndices{ static_cast<uint32_t>(mesh.indices.size() - 2) };
-			concurrency::parallel_for(0u, numIndices, [=, this](uint32_t vertIdx)
+			withFlag(normalMapping, [&](auto normalMap)
 				{
-					RenderMeshTriangle(mesh, screenVertices, vertIdx, vertIdx & 1);
-					//std::cout << vertIdx << "\n";
+					withFlag(specularMapping, [&](auto specularMaps)
+						{
+							withFlag(fastSpecular, [&](auto fastPow)
+								{
+									withFlag(localLights, [&](auto lights)
+										{
+											withFlag(shadows, [&](auto shadowMap)
+												{
+													draw(ShaderPermutation<RenderMode::FinalColor, Shading, decltype(normalMap)::value, decltype(specularMaps)::value,
+														decltype(fastPow)::value, decltype(lights)::value, decltype(shadowMap)::value>{});
+												}
+											);
+										}
+									);
+								}
+							);
+						}
+					);
 				}
 			);
-			/*for (size_t vertIdx{}; vertIdx < mesh.indices.size() - 2; ++vertIdx)
-			{
+		}
+	};
+	switch (m_ShadingMode)
+	{
+	default:
+	case ShadingMode::Combined:
+		dispatchMaps.template operator()<ShadingMode::Combined>(useNormalMap, useSpecularMaps, m_UseFastSpecular, useLocalLights, m_UseShadows);
+		break;
+	case ShadingMode::ObservedArea:
+		dispatchMaps.template operator()<ShadingMode::ObservedArea>(useNormalMap, false, true, false, false);
+		break;
+	case ShadingMode::Diffuse:
+		dispatchMaps.template operator()<ShadingMode::Diffuse>(useNormalMap, false, true, useLocalLights, m_UseShadows);
+		break;
+	case ShadingMode::Specular:
+		//Without specular maps the result is black, normal mapping it would be wasted
+		dispatchMaps.template operator()<ShadingMode::Specular>(useNormalMap && useSpecularMaps, useSpecularMaps, m_UseFastSpecular, useLocalLights && useSpecularMaps,
+			m_UseShadows && useSpecularMaps);
+		break;
+	case ShadingMode::PBR:
+		//Without specular maps every surface gets the same dielectric F0 and roughness
+		dispatchMaps.template operator()<ShadingMode::PBR>(useNormalMap, useSpecularMaps, true, useLocalLights, m_UseShadows);
+		break;
+	}
+}
 
-				RenderMeshTriangle(mesh, screenVertices, vertIdx, vertIdx & 1);
-			}*/
-			break;
+template<typename IndexType, typename Shader>
+void dae::Renderer::RenderMesh(const Mesh& mesh, const std::vector<Vector2>& screenVertices)
+{
+	const std::span<const IndexType> indices{ mesh.GetIndices<IndexType>() };
+	if (indices.size() < 3) return;
+
+	//Meshlets that are rejected as a whole never reach triangle setup
+	const bool useMeshlets{ m_UseClusterCulling && !mesh.meshlets.empty() };
+	std::vector<uint32_t> visibleMeshlets{};
+	if (useMeshlets)
+	{
+		visibleMeshlets.reserve(mesh.meshlets.size());
+		for (uint32_t meshletIdx{}; meshletIdx < static_cast<uint32_t>(mesh.meshlets.size()); ++meshletIdx)
+		{
+			if (IsMeshletVisible(mesh, mesh.meshlets[meshletIdx])) visibleMeshlets.push_back(meshletIdx);
 		}
-		case PrimitiveTopology::TriangleList:
-			const uint32_t numTriangles{ static_cast<uint32_t>(mesh.indices.size() - 2) / 3 };
-			concurrency::parallel_for(0u, numTriangles, [=, this](uint32_t vertIdx)
+	}
+
+	switch (mesh.primitiveTopology)
+	{
+	case PrimitiveTopology::TriangleStrip:
+	{
+		if (useMeshlets)
+		{
+			concurrency::parallel_for(0u, static_cast<uint32_t>(visibleMeshlets.size()), [&](uint32_t visibleIdx)
 				{
-					RenderMeshTriangle(mesh, screenVertices, vertIdx * 3);
-			
+					const Meshlet& meshlet{ mesh.meshlets[visibleMeshlets[visibleIdx]] };
+					RenderMeshStrip<IndexType, Shader>(mesh, screenVertices, meshlet.firstIndex, meshlet.numIndices);
 				}
 			);
-			/*for (uint32_t vertIdx{}; vertIdx < static_cast<uint32_t>(mesh.indices.size() - 2); vertIdx += 3)
+			break;
+		}
+
+		//Without meshlets the index buffer is cut into runs walked in parallel
+		//A run is moved forward to the next strip start, so it never begins halfway through a strip
+		constexpr uint32_t indicesPerRun{ 512 };
+		const uint32_t numIndices{ static_cast<uint32_t>(indices.size()) };
+		const uint32_t numRuns{ (numIndices + indicesPerRun - 1) / indicesPerRun };
+		const auto getRunStart{ [indices, numIndices](uint32_t runIdx)
+			{
+				uint32_t idx{ runIdx * indicesPerRun };
+				if (idx == 0 || idx >= numIndices) return std::min(idx, numIndices);
+				while (idx < numIndices && indices[idx - 1] != PrimitiveRestartIndex<IndexType>) ++idx;
+				return idx;
+			}
+		};
+		concurrency::parallel_for(0u, numRuns, [&](uint32_t runIdx)
 			{
-				RenderMeshTriangle(mesh, screenVertices, vertIdx);
-			}*/
+				const uint32_t runStart{ getRunStart(runIdx) };
+				RenderMeshStrip<IndexType, Shader>(mesh, screenVertices, runStart, getRunStart(runIdx + 1) - runStart);
+			}
+		);
+		break;
+	}
+	case PrimitiveTopology::TriangleList:
+	{
+		if (useMeshlets)
+		{
+			concurrency::parallel_for(0u, static_cast<uint32_t>(visibleMeshlets.size()), [&](uint32_t visibleIdx)
+				{
+					const Meshlet& meshlet{ mesh.meshlets[visibleMeshlets[visibleIdx]] };
+					RenderMeshList<IndexType, Shader>(mesh, screenVertices, meshlet.firstIndex, meshlet.numIndices);
+				}
+			);
 			break;
 		}
+
+		//Without meshlets the triangles are walked in runs, coarse shading samples are gathered across the triangles of a run
+		constexpr uint32_t trianglesPerRun{ 128 };
+		const uint32_t numTriangles{ static_cast<uint32_t>(indices.size() / 3) };
+		const uint32_t numRuns{ (numTriangles + trianglesPerRun - 1) / trianglesPerRun };
+		concurrency::parallel_for(0u, numRuns, [&](uint32_t runIdx)
+			{
+				const uint32_t runStart{ runIdx * trianglesPerRun };
+				RenderMeshList<IndexType, Shader>(mesh, screenVertices, runStart * 3, std::min(trianglesPerRun, numTriangles - runStart) * 3);
+			}
+		);
+		break;
+	}
 	}
 }
 
-void dae::Renderer::RenderMeshTriangle(const Mesh& mesh, const std::vector<Vector2>& screenVertices, uint32_t vertIdx, bool swapVertices)
+void dae::Renderer::RenderShadowMap()
 {
-	const uint32_t vertIdx0{ mesh.indices[vertIdx + swapVertices * 2] };
-	const uint32_t vertIdx1{ mesh.indices[vertIdx + 1] };
-	const uint32_t vertIdx2{ mesh.indices[vertIdx + !swapVertices * 2] };
+	//Stable fit: the bounding sphere of the shadowed part of the view frustum keeps its size while the camera turns
+	//and its center moves in whole texels, so shadow edges do not shimmer as the camera moves
+	const float tanX{ m_Camera.fov * m_Camera.aspectRatio };
+	const float tanY{ m_Camera.fov };
+	const float cornerSlope{ tanX * tanX + tanY * tanY };
+	const float nearDepth{ m_Camera.nearPlane };
+	const float farDepth{ std::min(m_ShadowDistance, m_Camera.farPlane) };
+	const float centerDepth{ std::min((farDepth + nearDepth) * (1.f + cornerSlope) * 0.5f, farDepth) };
+	const float radius{ sqrtf(farDepth * farDepth * cornerSlope + (farDepth - centerDepth) * (farDepth - centerDepth)) };
+
+	const Vector3 lightForward{ m_LightDirection.Normalized() };
+	const Vector3 lightRight{ Vector3::Cross(Vector3::UnitY, lightForward).Normalized() };
+	const Vector3 lightUp{ Vector3::Cross(lightForward, lightRight) };
+	//The light's axes are orthonormal, so the transpose is their inverse
+	const Matrix lightViewMatrix{ Matrix::Transpose(Matrix{ lightRight, lightUp, lightForward, Vector3::Zero }) };
 
-	if (vertIdx0 == vertIdx1 || vertIdx1 == vertIdx2 || vertIdx2 == vertIdx0) return;
+	const float texelSize{ 2.f * radius / m_ShadowMapSize };
+	Vector3 center{ lightViewMatrix.TransformPoint(m_Camera.origin + m_Camera.forward * centerDepth) };
+	center.x = floorf(center.x / texelSize) * texelSize;
+	center.y = floorf(center.y / texelSize) * texelSize;
+	//Casters up to one more sphere diameter towards the light still throw their shadow into the sphere
+	const float minDepth{ center.z - 3.f * radius };
+	const float maxDepth{ center.z + radius };
 
-	if (!GeometryUtils::IsVertexInFrustrum(mesh.vertices_out[vertIdx0].position)
-		|| !GeometryUtils::IsVertexInFrustrum(mesh.vertices_out[vertIdx1].position)
-		|| !GeometryUtils::IsVertexInFrustrum(mesh.vertices_out[vertIdx2].position))
+	const float texelsPerUnit{ 1.f / texelSize };
+	m_ShadowMatrix = lightViewMatrix * Matrix::CreateTranslation(radius - center.x, radius - center.y, -minDepth)
+		* Matrix::CreateScale(texelsPerUnit, texelsPerUnit, 1.f / (maxDepth - minDepth));
+	m_ShadowTexelSize = texelSize;
+
+	m_ShadowMap.resize(static_cast<size_t>(m_ShadowMapSize) * m_ShadowMapSize);
+	std::fill(m_ShadowMap.begin(), m_ShadowMap.end(), 1.f);
+	const DepthRasterizer::DepthTarget target{ m_ShadowMap.data(), m_ShadowMapSize, m_ShadowMapSize };
+	for (const Mesh& mesh : m_Meshes)
 	{
-		return;
+		//Only positions are transformed, the depth pass needs nothing else
+		const Matrix positionMatrix{ (mesh.vertexFormat == VertexFormat::Packed ? mesh.GetDequantizationMatrix() * mesh.worldMatrix : mesh.worldMatrix) * m_ShadowMatrix };
+		m_ShadowVertices.clear();
+		m_ShadowVertices.reserve(mesh.GetNumVertices());
+		if (mesh.vertexFormat == VertexFormat::Packed)
+		{
+			for (const PackedVertex& vertex : mesh.packedVertices)
+			{
+				m_ShadowVertices.push_back(positionMatrix.TransformPoint(
+					static_cast<float>(vertex.position[0]), static_cast<float>(vertex.position[1]), static_cast<float>(vertex.position[2])));
+			}
+		}
+		else
+		{
+			for (const Vertex& vertex : mesh.vertices) m_ShadowVertices.push_back(positionMatrix.TransformPoint(vertex.position));
+		}
+
+		if (mesh.indexFormat == IndexFormat::UInt16) DepthRasterizer::RasterizeMesh(target, m_ShadowVertices, mesh.GetIndices<uint16_t>(), mesh.primitiveTopology);
+		else DepthRasterizer::RasterizeMesh(target, m_ShadowVertices, mesh.GetIndices<uint32_t>(), mesh.primitiveTopology);
+	}
+}
+
+FloatPacket dae::Renderer::SampleShadow(const Vector3Packet& worldPosition, const Vector3Packet& normal) const
+{
+	//Normal offset, the receiver is moved off its surface by a texel and a half so it does not shadow itself
+	const Vector3Packet receiver{ worldPosition + normal * FloatPacket{ m_ShadowTexelSize * 1.5f } };
+	const Matrix& shadowMatrix{ m_ShadowMatrix };
+	const auto transform{ [&](int column)
+		{
+			return receiver.x * shadowMatrix[0][column] + receiver.y * shadowMatrix[1][column] + receiver.z * shadowMatrix[2][column] + shadowMatrix[3][column];
+		}
+	};
+	const FloatPacket shadowX{ transform(0) };
+	const FloatPacket shadowY{ transform(1) };
+	const FloatPacket receiverDepth{ transform(2) - 0.0005f };
+
+	//Percentage closer filtering, 9 depth comparisons around the receiver averaged
+	const float mapSize{ static_cast<float>(m_ShadowMapSize) };
+	const float maxTexel{ mapSize - 1.f };
+	FloatPacket litTexels{};
+	for (int offsetY{ -1 }; offsetY <= 1; ++offsetY)
+	{
+		const FloatPacket texelY{ Truncate(Min(Max(shadowY + static_cast<float>(offsetY), 0.f), maxTexel)) };
+		for (int offsetX{ -1 }; offsetX <= 1; ++offsetX)
+		{
+			const FloatPacket texelX{ Truncate(Min(Max(shadowX + static_cast<float>(offsetX), 0.f), maxTexel)) };
+			const FloatPacket casterDepth{ FloatPacket::Gather(m_ShadowMap.data(), texelY * mapSize + texelX) };
+			litTexels += FloatPacket{ 1.f } & (receiverDepth <= casterDepth);
+		}
+	}
+
+	const FloatPacket isInside{ (shadowX >= 0.f) & (shadowX < mapSize) & (shadowY >= 0.f) & (shadowY < mapSize) & (receiverDepth <= 1.f) };
+	return Select(isInside, litTexels * (1.f / 9.f), 1.f);
+}
+
+void dae::Renderer::UpdateShadingRates()
+{
+	m_ShadingRateTilesX = (m_Width + ShadingRateTileSize - 1) / ShadingRateTileSize;
+	const int tilesY{ (m_Height + ShadingRateTileSize - 1) / ShadingRateTileSize };
+	m_ShadingRates.resize(m_ShadingRateTilesX * tilesY);
+	if (m_MeasuredShadingRates.size() != m_ShadingRates.size()) m_MeasuredShadingRates.assign(m_ShadingRates.size(), ShadingRate::Rate1x1);
+
+	const float halfDiagonal{ sqrtf(static_cast<float>(m_Width * m_Width + m_Height * m_Height)) * 0.5f };
+	concurrency::parallel_for(0, tilesY, [&](int tileY)
+		{
+			const int minY{ tileY * ShadingRateTileSize };
+			const int maxY{ std::min(minY + ShadingRateTileSize, m_Height) };
+			for (int tileX{}; tileX < m_ShadingRateTilesX; ++tileX)
+			{
+				const int minX{ tileX * ShadingRateTileSize };
+				const int maxX{ std::min(minX + ShadingRateTileSize, m_Width) };
+				ShadingRate rate{ ShadingRate::Rate1x1 };
+				switch (m_ShadingRateSource)
+				{
+				case ShadingRateSource::Static:
+					rate = m_StaticShadingRate;
+					break;
+				case ShadingRateSource::LuminanceVariance:
+				{
+					//Tiles the background showed through hold a silhouette, or were empty and may not stay so, both keep the full rate
+					int numCovered{};
+					bool hasBackground{ false };
+					float luminanceSum{}, luminanceSquaredSum{};
+					for (int y{ minY }; y < maxY && !hasBackground; ++y)
+					{
+						for (int x{ minX }; x < maxX; ++x)
+						{
+							const int pixelIdx{ x + y * m_Width };
+							if (!(m_pDepthBufferPixels[pixelIdx] < 1.f))
+							{
+								hasBackground = true;
+								break;
+							}
+
+							uint8_t red{}, green{}, blue{};
+							SDL_GetRGB(m_pBackBufferPixels[pixelIdx], m_pBackBuffer->format, &red, &green, &blue);
+							const float luminance{ (0.2126f * red + 0.7152f * green + 0.0722f * blue) / 255.f };
+							luminanceSum += luminance;
+							luminanceSquaredSum += luminance * luminance;
+							++numCovered;
+						}
+					}
+					if (hasBackground || numCovered == 0) break;
+
+					const float mean{ luminanceSum / numCovered };
+					const float variance{ luminanceSquaredSum / numCovered - mean * mean };
+					if (variance < 0.0004f) rate = ShadingRate::Rate4x4;
+					else if (variance < 0.0025f) rate = ShadingRate::Rate2x2;
+					else if (variance < 0.01f) rate = ShadingRate::Rate2x1;
+					break;
+				}
+				case ShadingRateSource::ScreenCenter:
+				{
+					const float offsetX{ (minX + maxX) * 0.5f - m_Width * 0.5f };
+					const float offsetY{ (minY + maxY) * 0.5f - m_Height * 0.5f };
+					const float distance{ sqrtf(offsetX * offsetX + offsetY * offsetY) / halfDiagonal };
+					if (distance > 0.8f) rate = ShadingRate::Rate4x4;
+					else if (distance > 0.6f) rate = ShadingRate::Rate2x2;
+					else if (distance > 0.4f) rate = ShadingRate::Rate2x1;
+					break;
+				}
+				}
+				if (m_ShadingRateSource == ShadingRateSource::LuminanceVariance)
+				{
+					//A coarsely shaded tile looks flatter than it is, only the reference row of the last frame was shaded at the full rate and may get coarser
+					//Everywhere else the measurement can only make the tile finer
+					ShadingRate& measuredRate{ m_MeasuredShadingRates[tileY * m_ShadingRateTilesX + tileX] };
+					if (tileY == m_ShadingRateReferenceRow || rate < measuredRate) measuredRate = rate;
+					rate = measuredRate;
+				}
+				m_ShadingRates[tileY * m_ShadingRateTilesX + tileX] = rate;
+			}
+		}
+	);
+
+	//One row per frame is shaded at the full rate, so every tile gets an honest measurement once per cycle through the rows
+	if (m_ShadingRateSource == ShadingRateSource::LuminanceVariance)
+	{
+		m_ShadingRateReferenceRow = (m_ShadingRateReferenceRow + 1) % tilesY;
+		std::fill_n(m_ShadingRates.begin() + m_ShadingRateReferenceRow * m_ShadingRateTilesX, m_ShadingRateTilesX, ShadingRate::Rate1x1);
+	}
+}
+
+bool dae::Renderer::IsMeshletVisible(const Mesh& mesh, const Meshlet& meshlet) const
+{
+	//Scene meshes are only rotated and translated, so the radius and cone angle carry over to world space unchanged
+	const Vector3 center{ mesh.worldMatrix.TransformPoint(meshlet.center) };
+	if (meshlet.coneCutoff < 1.f
+		&& GeometryUtils::IsConeBackFacing(center, meshlet.radius, mesh.worldMatrix.TransformVector(meshlet.coneAxis), meshlet.coneCutoff, m_Camera.origin))
+	{
+		return false;
+	}
+
+	return GeometryUtils::IsSphereInFrustum(m_Camera.viewMatrix.TransformPoint(center), meshlet.radius,
+		m_Camera.fov, m_Camera.aspectRatio, m_Camera.nearPlane, m_Camera.farPlane);
+}
+
+template<typename IndexType, typename Shader>
+void dae::Renderer::RenderMeshList(const Mesh& mesh, const std::vector<Vector2>& screenVertices, uint32_t firstIndex, uint32_t numIndices)
+{
+	const std::span<const IndexType> indices{ mesh.GetIndices<IndexType>() };
+	CoarseShadingBatch coarseShading;
+	for (uint32_t vertIdx{ firstIndex }; vertIdx + 2 < firstIndex + numIndices; vertIdx += 3)
+	{
+		const uint32_t vertIdx0{ indices[vertIdx] };
+		const uint32_t vertIdx1{ indices[vertIdx + 1] };
+		const uint32_t vertIdx2{ indices[vertIdx + 2] };
+		if (vertIdx0 == vertIdx1 || vertIdx1 == vertIdx2 || vertIdx2 == vertIdx0) continue;
+
+		if (!GeometryUtils::IsVertexInFrustrum(mesh.vertices_out[vertIdx0].position)
+			|| !GeometryUtils::IsVertexInFrustrum(mesh.vertices_out[vertIdx1].position)
+			|| !GeometryUtils::IsVertexInFrustrum(mesh.vertices_out[vertIdx2].position))
+		{
+			continue;
+		}
+
+		RenderMeshTriangle<Shader>(mesh, screenVertices, vertIdx0, vertIdx1, vertIdx2, coarseShading);
 	}
+	FlushCoarseShading<Shader>(coarseShading);
+}
+
+template<typename IndexType, typename Shader>
+void dae::Renderer::RenderMeshStrip(const Mesh& mesh, const std::vector<Vector2>& screenVertices, uint32_t firstIndex, uint32_t numIndices)
+{
+	const std::span<const IndexType> indices{ mesh.GetIndices<IndexType>() };
+	//Consecutive triangles share two vertices, their index loads, frustum tests and 1/w carry over to the next triangle
+	//Strips only ever hold real triangles, they are joined with restarts instead of degenerate triangles
+	uint32_t vertIdx0{}, vertIdx1{};
+	bool isInFrustum0{}, isInFrustum1{};
+	float invPosW0{}, invPosW1{};
+	uint32_t numStripVertices{};
+	CoarseShadingBatch coarseShading;
+	for (uint32_t idx{ firstIndex }; idx < firstIndex + numIndices; ++idx)
+	{
+		const IndexType index{ indices[idx] };
+		if (index == PrimitiveRestartIndex<IndexType>)
+		{
+			numStripVertices = 0;
+			continue;
+		}
 
+		const uint32_t vertIdx2{ index };
+		const Vector4& position2{ mesh.vertices_out[vertIdx2].position };
+		const bool isInFrustum2{ GeometryUtils::IsVertexInFrustrum(position2) };
+		const float invPosW2{ 1.f / position2.w };
+		if (numStripVertices >= 2 && isInFrustum0 && isInFrustum1 && isInFrustum2)
+		{
+			//Every odd triangle of a strip has its outer vertices swapped to keep the winding
+			if (numStripVertices & 1)
+			{
+				const float corners[3]{ invPosW2, invPosW1, invPosW0 };
+				RenderMeshTriangle<Shader>(mesh, screenVertices, vertIdx2, vertIdx1, vertIdx0, coarseShading, corners);
+			}
+			else
+			{
+				const float corners[3]{ invPosW0, invPosW1, invPosW2 };
+				RenderMeshTriangle<Shader>(mesh, screenVertices, vertIdx0, vertIdx1, vertIdx2, coarseShading, corners);
+			}
+		}
+
+		vertIdx0 = vertIdx1;
+		vertIdx1 = vertIdx2;
+		isInFrustum0 = isInFrustum1;
+		isInFrustum1 = isInFrustum2;
+		invPosW0 = invPosW1;
+		invPosW1 = invPosW2;
+		++numStripVertices;
+	}
+	FlushCoarseShading<Shader>(coarseShading);
+}
+
+//The components of a Vertex_OutPacket in declaration order, the layout of a CoarseShadingBatch
+static std::array<FloatPacket*, 14> GetComponents(Vertex_OutPacket& v)
+{
+	return { &v.uv.x, &v.uv.y, &v.normal.x, &v.normal.y, &v.normal.z, &v.tangent.x, &v.tangent.y, &v.tangent.z,
+		&v.viewDirection.x, &v.viewDirection.y, &v.viewDirection.z, &v.worldPosition.x, &v.worldPosition.y, &v.worldPosition.z };
+}
+
+template<typename Shader>
+void dae::Renderer::RenderMeshTriangle(const Mesh& mesh, const std::vector<Vector2>& screenVertices, uint32_t vertIdx0, uint32_t vertIdx1, uint32_t vertIdx2,
+	CoarseShadingBatch& coarseShading, const float* pInvPosW)
+{
 	Vector2 boundingBoxMin{ Vector2::Min(screenVertices[vertIdx0], Vector2::Min(screenVertices[vertIdx1], screenVertices[vertIdx2])) };
 	Vector2 boundingBoxMax{ Vector2::Max(screenVertices[vertIdx0], Vector2::Max(screenVertices[vertIdx1], screenVertices[vertIdx2])) };
 
 	const Vector2 screenVector{ static_cast<float>(m_Width), static_cast<float>(m_Height) };
 	boundingBoxMin = Vector2::Max(Vector2::Zero, Vector2::Min(boundingBoxMin, screenVector));
 	boundingBoxMax = Vector2::Max(Vector2::Zero, Vector2::Min(boundingBoxMax, screenVector));
-	for (int px{ static_cast<int>(boundingBoxMin.x) }; px < boundingBoxMax.x; ++px)
+
+	//Triangle setup, everything the pixel loop interpolates becomes a plane equation that is stepped by addition
+	//Back facing and degenerate triangles cover no pixel, they are dropped before any setup
+	const Vector2& screenVertex0{ screenVertices[vertIdx0] };
+	const Vector2& screenVertex1{ screenVertices[vertIdx1] };
+	const Vector2& screenVertex2{ screenVertices[vertIdx2] };
+	const float doubleArea{ Vector2::Cross(screenVertex1 - screenVertex0, screenVertex2 - screenVertex0) };
+	if (!(doubleArea > 0.f)) return;
+
+	using GeometryUtils::PlaneEquation;
+	const float invDoubleArea{ 1.f / doubleArea };
+	const PlaneEquation weightPlaneV0{ PlaneEquation::FromEdge(screenVertex1, screenVertex2, screenVertex0, invDoubleArea) };
+	const PlaneEquation weightPlaneV1{ PlaneEquation::FromEdge(screenVertex2, screenVertex0, screenVertex0, invDoubleArea) };
+	const PlaneEquation weightPlaneV2{ PlaneEquation::FromEdge(screenVertex0, screenVertex1, screenVertex0, invDoubleArea) };
+	const auto fromCorners{ [&](float value0, float value1, float value2)
+		{
+			return PlaneEquation::FromWeights(weightPlaneV0, weightPlaneV1, weightPlaneV2, value0, value1, value2);
+		}
+	};
+
+	const Vertex_Out& vertex0{ mesh.vertices_out[vertIdx0] };
+	const Vertex_Out& vertex1{ mesh.vertices_out[vertIdx1] };
+	const Vertex_Out& vertex2{ mesh.vertices_out[vertIdx2] };
+	//NDC depth is affine in screen space, it is interpolated as it is, like the depth rasterizer does
+	const PlaneEquation depthPlane{ fromCorners(vertex0.position.z, vertex1.position.z, vertex2.position.z) };
+	const float inv0PosW{ pInvPosW ? pInvPosW[0] : 1.f / vertex0.position.w };
+	const float inv1PosW{ pInvPosW ? pInvPosW[1] : 1.f / vertex1.position.w };
+	const float inv2PosW{ pInvPosW ? pInvPosW[2] : 1.f / vertex2.position.w };
+	const PlaneEquation invPosWPlane{ fromCorners(inv0PosW, inv1PosW, inv2PosW) };
+
+	//Declared varyings are divided by w and packed one component per plane, in the order of the Varyings flags
+	constexpr uint32_t varyings{ Shader::varyings };
+	constexpr bool usesViewDirectionPlanes{ (varyings & (Varyings::ViewDirection | Varyings::WorldPosition)) != 0 };
+	constexpr int numVaryingPlanes{ ((varyings & Varyings::UV) != 0 ? 2 : 0) + ((varyings & Varyings::Normal) != 0 ? 3 : 0)
+		+ ((varyings & Varyings::Tangent) != 0 ? 3 : 0) + (usesViewDirectionPlanes ? 3 : 0) };
+	PlaneEquation varyingPlanes[std::max(numVaryingPlanes, 1)]{};
+	int numSetUpPlanes{};
+	const auto setUpVarying{ [&](const auto& attribute0, const auto& attribute1, const auto& attribute2, int numComponents)
+		{
+			for (int componentIdx{}; componentIdx < numComponents; ++componentIdx)
+			{
+				varyingPlanes[numSetUpPlanes++] = fromCorners(attribute0[componentIdx] * inv0PosW, attribute1[componentIdx] * inv1PosW, attribute2[componentIdx] * inv2PosW);
+			}
+		}
+	};
+	if constexpr ((varyings & Varyings::UV) != 0) setUpVarying(vertex0.uv, vertex1.uv, vertex2.uv, 2);
+	if constexpr ((varyings & Varyings::Normal) != 0) setUpVarying(vertex0.normal, vertex1.normal, vertex2.normal, 3);
+	if constexpr ((varyings & Varyings::Tangent) != 0) setUpVarying(vertex0.tangent, vertex1.tangent, vertex2.tangent, 3);
+	if constexpr (usesViewDirectionPlanes) setUpVarying(vertex0.viewDirection, vertex1.viewDirection, vertex2.viewDirection, 3);
+
+	//Pixels are walked in 2x2 quads on even coordinates, a packet holds PacketWidth / 4 quads side by side
+	//Lanes outside the triangle or behind the depth buffer are masked off, but still interpolated as helpers so PixelShading can take derivatives across a quad
+	//The planes are relative to the first vertex, each row of quads starts from an exact evaluation so the additions cannot drift further than one row
+	//Columns start on a multiple of four as well, so no packet straddles a 4x4 shading cell or a shading rate tile
+	const int quadMinX{ static_cast<int>(boundingBoxMin.x) & ~3 };
+	const int quadMinY{ static_cast<int>(boundingBoxMin.y) & ~1 };
+	const FloatPacket packetStep{ static_cast<float>(QuadColumns) };
+
+	//4x4 cells are looked up by cell column, see CoarseCell
+	constexpr int maxCoarseCells{ 64 };
+	CoarseCell coarseCells[maxCoarseCells];
+	const bool useCoarseShading{ Shader::renderMode == RenderMode::FinalColor && m_UseVariableRateShading };
+	if (useCoarseShading)
 	{
-		for (int py{ static_cast<int>(boundingBoxMin.y) }; py < boundingBoxMax.y; ++py)
+		const int numCoarseCells{ std::min((static_cast<int>(boundingBoxMax.x) - quadMinX) / 4 + 1, maxCoarseCells) };
+		for (int cellIdx{}; cellIdx < numCoarseCells; ++cellIdx) coarseCells[cellIdx].cellX = -1;
+	}
+	const auto writePixel{ [this](int pixelIdx, float red, float green, float blue)
 		{
-			const int pixelIdx{ px + py * m_Width };
-			const Vector2 pixelCoordinates{ static_cast<float>(px), static_cast<float>(py) };
-			float signedAreaV0V1, signedAreaV1V2, signedAreaV2V0;
+			m_pBackBufferPixels[pixelIdx] = SDL_MapRGB(m_pBackBuffer->format, static_cast<uint8_t>(red * 255), static_cast<uint8_t>(green * 255), static_cast<uint8_t>(blue * 255));
+		}
+	};
+	for (int py{ quadMinY }; py < boundingBoxMax.y; py += 2)
+	{
+		const float rowX{ static_cast<float>(quadMinX) };
+		const float rowY{ static_cast<float>(py) };
+		const float planeX{ rowX - screenVertex0.x };
+		const float planeY{ rowY - screenVertex0.y };
+		FloatPacket rowWeightV0{ weightPlaneV0.EvaluateQuads(planeX, planeY) };
+		FloatPacket rowWeightV1{ weightPlaneV1.EvaluateQuads(planeX, planeY) };
+		FloatPacket rowWeightV2{ weightPlaneV2.EvaluateQuads(planeX, planeY) };
+		FloatPacket rowDepth{ depthPlane.EvaluateQuads(planeX, planeY) };
+		FloatPacket rowInvPosW{ invPosWPlane.EvaluateQuads(planeX, planeY) };
+		FloatPacket rowVaryings[std::max(numVaryingPlanes, 1)]{};
+		for (int planeIdx{}; planeIdx < numVaryingPlanes; ++planeIdx) rowVaryings[planeIdx] = varyingPlanes[planeIdx].EvaluateQuads(planeX, planeY);
+		FloatPacket pixelX{ FloatPacket{ rowX } + FloatPacket::QuadLaneX() };
+		const FloatPacket pixelY{ FloatPacket{ rowY } + FloatPacket::QuadLaneY() };
 
-			if (GeometryUtils::IsPointInTriangle(screenVertices[vertIdx0], screenVertices[vertIdx1],
-				screenVertices[vertIdx2], pixelCoordinates, signedAreaV0V1, signedAreaV1V2, signedAreaV2V0))
+		for (int px{ quadMinX }; px < boundingBoxMax.x; px += QuadColumns)
+		{
+			//Take this packet's values and step the row ahead right away, skipped packets still have to advance
+			const FloatPacket weightV0{ rowWeightV0 };
+			const FloatPacket weightV1{ rowWeightV1 };
+			const FloatPacket weightV2{ rowWeightV2 };
+			const FloatPacket depthInterpolated{ rowDepth };
+			const FloatPacket invPosW{ rowInvPosW };
+			const FloatPacket packetX{ pixelX };
+			FloatPacket packetVaryings[std::max(numVaryingPlanes, 1)];
+			for (int planeIdx{}; planeIdx < numVaryingPlanes; ++planeIdx)
 			{
-				const float triangleArea{ 1.f / (Vector2::Cross(screenVertices[vertIdx1] - screenVertices[vertIdx0],
-					screenVertices[vertIdx2] - screenVertices[vertIdx0])) };
+				packetVaryings[planeIdx] = rowVaryings[planeIdx];
+				rowVaryings[planeIdx] += FloatPacket{ varyingPlanes[planeIdx].dx * QuadColumns };
+			}
+			rowWeightV0 += FloatPacket{ weightPlaneV0.dx * QuadColumns };
+			rowWeightV1 += FloatPacket{ weightPlaneV1.dx * QuadColumns };
+			rowWeightV2 += FloatPacket{ weightPlaneV2.dx * QuadColumns };
+			rowDepth += FloatPacket{ depthPlane.dx * QuadColumns };
+			rowInvPosW += FloatPacket{ invPosWPlane.dx * QuadColumns };
+			pixelX += packetStep;
 
-				const float weightV0{ signedAreaV1V2 * triangleArea };
-				const float weightV1{ signedAreaV2V0 * triangleArea };
-				const float weightV2{ signedAreaV0V1 * triangleArea };
+			const FloatPacket isInside{ (weightV0 >= 0.f) & (weightV1 >= 0.f) & (weightV2 >= 0.f) & (packetX < boundingBoxMax.x) & (pixelY < boundingBoxMax.y) };
+			uint32_t laneMask{ isInside.GetMask() };
+			if (laneMask == 0) continue;
 
-				const float depthInterpolated
-				{
-					1.f / (1.f / mesh.vertices_out[vertIdx0].position.z * weightV0 +
-					1.f / mesh.vertices_out[vertIdx1].position.z * weightV1 +
-					1.f / mesh.vertices_out[vertIdx2].position.z * weightV2)
-				};
+			laneMask &= ((depthInterpolated >= 0.f) & (depthInterpolated <= 1.f)).GetMask();
 
-				if (m_pDepthBufferPixels[pixelIdx] <= depthInterpolated || depthInterpolated < 0.f || depthInterpolated > 1.f) continue;
-				m_pDepthBufferPixels[pixelIdx] = depthInterpolated;
+			float depths[PacketWidth];
+			depthInterpolated.Store(depths);
+			for (uint32_t lanes{ laneMask }; lanes != 0; lanes &= lanes - 1)
+			{
+				const int lane{ std::countr_zero(lanes) };
+				float& bufferDepth{ m_pDepthBufferPixels[px + GetQuadLaneX(lane) + (py + GetQuadLaneY(lane)) * m_Width] };
+				if (bufferDepth <= depths[lane]) laneMask &= ~(1u << lane);
+				else bufferDepth = depths[lane];
+			}
+			if (laneMask == 0) continue;
 
-				ColorRGB finalColor{};
-				switch (m_RenderMode)
-				{
-				default:
-				case RenderMode::FinalColor:
+			//Coarse tiles shade one sample per cell, clearing the low lane bits maps a lane to the first lane of its cell
+			//The quad layout puts 2x1 cells on lane pairs, 2x2 cells on quads and 4x4 cells on whole packets, though a 4x4 cell also spans several packets
+			const ShadingRate shadingRate{ useCoarseShading ? GetShadingRate(px, py) : ShadingRate::Rate1x1 };
+			CoarseCell* pCoarseCell{ nullptr };
+			if (shadingRate == ShadingRate::Rate4x4)
+			{
+				pCoarseCell = &coarseCells[((px - quadMinX) / 4) % maxCoarseCells];
+				if (pCoarseCell->cellX == px / 4 && pCoarseCell->cellY == py / 4)
 				{
+					//An earlier packet took the sample of this cell, the pixels join it without interpolating anything
+					for (uint32_t lanes{ laneMask }; lanes != 0; lanes &= lanes - 1)
+					{
+						const int lane{ std::countr_zero(lanes) };
+						const int pixelIdx{ px + GetQuadLaneX(lane) + (py + GetQuadLaneY(lane)) * m_Width };
+						if (pCoarseCell->sample >= 0) coarseShading.pixels[coarseShading.numPixels++] = { pixelIdx, pCoarseCell->sample, depths[lane] };
+						else writePixel(pixelIdx, pCoarseCell->red, pCoarseCell->green, pCoarseCell->blue);
+					}
+					continue;
+				}
+			}
 
-					const float inv0PosW{ 1.f / mesh.vertices_out[vertIdx0].position.w };
-					const float inv1PosW{ 1.f / mesh.vertices_out[vertIdx1].position.w };
-					const float inv2PosW{ 1.f / mesh.vertices_out[vertIdx2].position.w };
+			ColorPacket finalColor{};
+			if constexpr (Shader::renderMode == RenderMode::FinalColor)
+			{
+				Vertex_OutPacket interpolatedVertices{};
+				FloatPacket uvLod{};
+				uint32_t clusterIndices[PacketWidth]{};
+				if constexpr (varyings != Varyings::None)
+				{
+					//The single reciprocal of the perspective correction, every varying is its plane times the view depth
+					const FloatPacket viewDepthInterpolated{ FloatPacket{ 1.f } / invPosW };
+					int planeIdx{};
+					const auto interpolateVector{ [&]()
+						{
+							const Vector3Packet vector{ packetVaryings[planeIdx] * viewDepthInterpolated, packetVaryings[planeIdx + 1] * viewDepthInterpolated,
+								packetVaryings[planeIdx + 2] * viewDepthInterpolated };
+							planeIdx += 3;
+							return vector;
+						}
+					};
 
-					const float viewDepthInterpolated
+					if constexpr ((varyings & Varyings::UV) != 0)
 					{
-						1.f / (1.f * inv0PosW * weightV0 +
-						1.f * inv1PosW * weightV1 +
-						1.f * inv2PosW * weightV2)
-					};
+						interpolatedVertices.uv = Vector2Packet{ packetVaryings[0] * viewDepthInterpolated, packetVaryings[1] * viewDepthInterpolated };
+						planeIdx += 2;
 
-					const Vector2 pixelUV
+						//log2 of the uv footprint of the pixel, from the derivatives across its quad, the longer screen axis decides
+						const Vector2Packet uvDx{ DDX(interpolatedVertices.uv) };
+						const Vector2Packet uvDy{ DDY(interpolatedVertices.uv) };
+						const FloatPacket footprint{ Max(uvDx.x * uvDx.x + uvDx.y * uvDx.y, uvDy.x * uvDy.x + uvDy.y * uvDy.y) };
+						uvLod = Log2(Max(footprint, 1e-20f)) * 0.5f;
+					}
+					if constexpr ((varyings & Varyings::Normal) != 0) interpolatedVertices.normal = interpolateVector().Normalized();
+					if constexpr ((varyings & Varyings::Tangent) != 0) interpolatedVertices.tangent = interpolateVector().Normalized();
+					if constexpr (usesViewDirectionPlanes)
 					{
-						(mesh.vertices_out[vertIdx0].uv * inv0PosW  * weightV0 +
-						mesh.vertices_out[vertIdx1].uv * inv1PosW * weightV1 +
-						mesh.vertices_out[vertIdx2].uv * inv2PosW * weightV2) * viewDepthInterpolated
-					};
+						const Vector3Packet cameraToSurface{ interpolateVector() };
+						if constexpr ((varyings & Varyings::ViewDirection) != 0) interpolatedVertices.viewDirection = cameraToSurface.Normalized();
+						if constexpr ((varyings & Varyings::WorldPosition) != 0) interpolatedVertices.worldPosition = cameraToSurface + m_Camera.origin;
+					}
 
-					const Vector3 normal
+					if constexpr (Shader::useLocalLights)
 					{
-						(mesh.vertices_out[vertIdx0].normal * inv0PosW * weightV0 +
-						mesh.vertices_out[vertIdx1].normal * inv1PosW * weightV1 +
-						mesh.vertices_out[vertIdx2].normal * inv2PosW * weightV2) * viewDepthInterpolated
-					};
+						float viewDepths[PacketWidth];
+						viewDepthInterpolated.Store(viewDepths);
+						for (uint32_t lanes{ laneMask }; lanes != 0; lanes &= lanes - 1)
+						{
+							const int lane{ std::countr_zero(lanes) };
+							clusterIndices[lane] = m_LightClusters.GetClusterIndex(px + GetQuadLaneX(lane), py + GetQuadLaneY(lane), viewDepths[lane]);
+						}
+					}
+				}
 
-					const Vector3 tangent
+				if (shadingRate != ShadingRate::Rate1x1)
+				{
+					//The lod bias is the log2 of the longer side of the cell, a cell covers more texels than the quad its derivatives come from
+					int cellLaneMask{ ~1 };
+					float uvLodBias{ 1.f };
+					if (shadingRate == ShadingRate::Rate2x2) cellLaneMask = ~3;
+					else if (shadingRate == ShadingRate::Rate4x4)
 					{
-						(mesh.vertices_out[vertIdx0].tangent * inv0PosW * weightV0 +
-						mesh.vertices_out[vertIdx1].tangent * inv1PosW * weightV1 +
-						mesh.vertices_out[vertIdx2].tangent * inv2PosW * weightV2) * viewDepthInterpolated
-					};
+						cellLaneMask = ~7;
+						uvLodBias = 2.f;
+					}
+					const uint32_t cellLanes{ (1u << (~cellLaneMask + 1)) - 1 };
 
-					const Vector3 viewDirection
+					//The first covered lane of each cell becomes a sample of the batch, the other covered lanes of the cell wait for its color
+					const std::array<FloatPacket*, 14> components{ GetComponents(interpolatedVertices) };
+					float componentLanes[14][PacketWidth];
+					for (size_t componentIdx{}; componentIdx < components.size(); ++componentIdx) components[componentIdx]->Store(componentLanes[componentIdx]);
+					float uvLods[PacketWidth];
+					(uvLod + uvLodBias).Store(uvLods);
+					for (uint32_t lanes{ laneMask }; lanes != 0;)
 					{
-						(mesh.vertices_out[vertIdx0].viewDirection * inv0PosW * weightV0 +
-						mesh.vertices_out[vertIdx1].viewDirection * inv1PosW * weightV1 +
-						mesh.vertices_out[vertIdx2].viewDirection * inv2PosW * weightV2) * viewDepthInterpolated
-					};
+						const int sourceLane{ std::countr_zero(lanes) };
+						const uint32_t sameCellLanes{ lanes & (cellLanes << (sourceLane & cellLaneMask)) };
+						lanes &= ~sameCellLanes;
 
-					Vertex_Out interpolatedVertex{};
-					interpolatedVertex.uv = pixelUV;
-					interpolatedVertex.normal = normal.Normalized();
-					interpolatedVertex.tangent = tangent.Normalized();
-					interpolatedVertex.viewDirection = viewDirection.Normalized();
-					finalColor = PixelShading(interpolatedVertex);
-				}
-				break;
-				case RenderMode::DepthBuffer:
-				{
-					const float depthRemapped{ DepthRemap(depthInterpolated, 0.997f, 1.f) };
-					finalColor = ColorRGB{ depthRemapped, depthRemapped, depthRemapped };
-				}
-				}
+						if (coarseShading.numSamples == PacketWidth) FlushCoarseShading<Shader>(coarseShading);
+						const int sample{ coarseShading.numSamples++ };
+						for (size_t componentIdx{}; componentIdx < components.size(); ++componentIdx)
+						{
+							coarseShading.components[componentIdx][sample] = componentLanes[componentIdx][sourceLane];
+						}
+						coarseShading.uvLods[sample] = uvLods[sourceLane];
+						coarseShading.clusterIndices[sample] = clusterIndices[sourceLane];
+						coarseShading.pCells[sample] = pCoarseCell;
+						if (pCoarseCell) *pCoarseCell = CoarseCell{ px / 4, py / 4, sample };
 
+						for (uint32_t cellPixels{ sameCellLanes }; cellPixels != 0; cellPixels &= cellPixels - 1)
+						{
+							const int lane{ std::countr_zero(cellPixels) };
+							coarseShading.pixels[coarseShading.numPixels++] = { px + GetQuadLaneX(lane) + (py + GetQuadLaneY(lane)) * m_Width, sample, depths[lane] };
+						}
+					}
+					continue;
+				}
+				finalColor = PixelShading<Shader>(interpolatedVertices, uvLod, laneMask, clusterIndices);
+			}
+			else
+			{
+				//Depth only, none of the vertex attributes are interpolated
+				constexpr float remapMin{ 0.997f };
+				constexpr float remapMax{ 1.f };
+				const FloatPacket depthRemapped{ (Min(Max(depthInterpolated, remapMin), remapMax) - remapMin) / (remapMax - remapMin) };
+				finalColor = ColorPacket{ depthRemapped, depthRemapped, depthRemapped };
+			}
 
-				//Update Color in Buffer
-				finalColor.MaxToOne();
+			//Update Color in Buffer
+			finalColor.MaxToOne();
 
-				m_pBackBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBackBuffer->format,
-					static_cast<uint8_t>(finalColor.r * 255),
-					static_cast<uint8_t>(finalColor.g * 255),
-					static_cast<uint8_t>(finalColor.b * 255));
+			float red[PacketWidth], green[PacketWidth], blue[PacketWidth];
+			finalColor.r.Store(red);
+			finalColor.g.Store(green);
+			finalColor.b.Store(blue);
+			for (uint32_t lanes{ laneMask }; lanes != 0; lanes &= lanes - 1)
+			{
+				const int lane{ std::countr_zero(lanes) };
+				writePixel(px + GetQuadLaneX(lane) + (py + GetQuadLaneY(lane)) * m_Width, red[lane], green[lane], blue[lane]);
 			}
 		}
 	}
+
+	//Samples still waiting in the batch outlive this triangle's cells
+	for (int sample{}; sample < coarseShading.numSamples; ++sample) coarseShading.pCells[sample] = nullptr;
+}
+
+template<typename Shader>
+void dae::Renderer::FlushCoarseShading(CoarseShadingBatch& batch)
+{
+	if (batch.numSamples == 0) return;
+
+	Vertex_OutPacket samples{};
+	const std::array<FloatPacket*, 14> components{ GetComponents(samples) };
+	for (size_t componentIdx{}; componentIdx < components.size(); ++componentIdx) *components[componentIdx] = FloatPacket::Load(batch.components[componentIdx]);
+	ColorPacket color{ PixelShading<Shader>(samples, FloatPacket::Load(batch.uvLods), (1u << batch.numSamples) - 1, batch.clusterIndices) };
+	color.MaxToOne();
+
+	float red[PacketWidth], green[PacketWidth], blue[PacketWidth];
+	color.r.Store(red);
+	color.g.Store(green);
+	color.b.Store(blue);
+	for (int sample{}; sample < batch.numSamples; ++sample)
+	{
+		CoarseCell* pCell{ batch.pCells[sample] };
+		if (pCell) *pCell = CoarseCell{ pCell->cellX, pCell->cellY, -1, red[sample], green[sample], blue[sample] };
+	}
+
+	//A pixel whose depth changed since went to a nearer triangle, of this batch or of another thread
+	for (int pixelIdx{}; pixelIdx < batch.numPixels; ++pixelIdx)
+	{
+		const CoarseShadingBatch::PendingPixel& pixel{ batch.pixels[pixelIdx] };
+		if (m_pDepthBufferPixels[pixel.pixelIdx] != pixel.depth) continue;
+
+		m_pBackBufferPixels[pixel.pixelIdx] = SDL_MapRGB(m_pBackBuffer->format,
+			static_cast<uint8_t>(red[pixel.sample] * 255),
+			static_cast<uint8_t>(green[pixel.sample] * 255),
+			static_cast<uint8_t>(blue[pixel.sample] * 255));
+	}
+	batch.numSamples = 0;
+	batch.numPixels = 0;
 }
 
 void dae::Renderer::CycleRenderMode()
@@ -524,52 +1245,223 @@ void dae::Renderer::CycleShadingMode()
 	m_ShadingMode = static_cast<ShadingMode>((currentMode + 1) % count);
 }
 
-ColorRGB dae::Renderer::PixelShading(const Vertex_Out& v)
+void dae::Renderer::ToggleFastSpecular()
+{
+	m_UseFastSpecular = !m_UseFastSpecular;
+}
+
+void dae::Renderer::ToggleVariableRateShading()
+{
+	m_UseVariableRateShading = !m_UseVariableRateShading;
+	//The measured rates are stale by now, they start over from the full rate
+	m_MeasuredShadingRates.clear();
+}
+
+ColorRGB dae::Renderer::SampleDiffuse(const Vector2& uv, float textureLod) const
+{
+	if (m_pVirtualDiffuseTexture) return m_pVirtualDiffuseTexture->Sample(uv, textureLod);
+	if (!m_pDiffuseTexture) return colors::Gray;
+	return m_pDiffuseTexture->Sample(uv, textureLod);
+}
+
+//Mip level of a texture of this size, from the log2 of the uv footprint of a pixel
+static FloatPacket GetTextureLod(const FloatPacket& uvLod, int width, int height)
+{
+	return uvLod + 0.5f * log2f(static_cast<float>(width) * height);
+}
+
+//Textures are sampled one lane at a time, only lanes in the mask are looked up
+template<typename SampleFunction>
+static Vector3Packet SampleLanes(const Vector2Packet& uv, const FloatPacket& lod, uint32_t laneMask, const SampleFunction& sample)
+{
+	float u[PacketWidth], v[PacketWidth], lods[PacketWidth];
+	uv.x.Store(u);
+	uv.y.Store(v);
+	lod.Store(lods);
+
+	float x[PacketWidth]{}, y[PacketWidth]{}, z[PacketWidth]{};
+	for (uint32_t lanes{ laneMask }; lanes != 0; lanes &= lanes - 1)
+	{
+		const int lane{ std::countr_zero(lanes) };
+		sample(Vector2{ u[lane], v[lane] }, lods[lane], x[lane], y[lane], z[lane]);
+	}
+	return Vector3Packet{ FloatPacket::Load(x), FloatPacket::Load(y), FloatPacket::Load(z) };
+}
+
+ColorPacket dae::Renderer::SampleDiffuse(const Vector2Packet& uv, uint32_t laneMask, const FloatPacket& uvLod) const
+{
+	FloatPacket textureLod{};
+	if (m_pVirtualDiffuseTexture) textureLod = GetTextureLod(uvLod, m_pVirtualDiffuseTexture->GetWidth(), m_pVirtualDiffuseTexture->GetHeight());
+	else if (m_pDiffuseTexture) textureLod = GetTextureLod(uvLod, m_pDiffuseTexture->GetWidth(), m_pDiffuseTexture->GetHeight());
+
+	const Vector3Packet color{ SampleLanes(uv, textureLod, laneMask, [&](const Vector2& laneUV, float laneLod, float& r, float& g, float& b)
+		{
+			const ColorRGB sampled{ SampleDiffuse(laneUV, laneLod) };
+			r = sampled.r;
+			g = sampled.g;
+			b = sampled.b;
+		}
+	) };
+	return ColorPacket{ color.x, color.y, color.z };
+}
+
+static ColorPacket SampleColor(const Texture& texture, const Vector2Packet& uv, const FloatPacket& uvLod, uint32_t laneMask)
+{
+	const FloatPacket textureLod{ GetTextureLod(uvLod, texture.GetWidth(), texture.GetHeight()) };
+	const Vector3Packet color{ SampleLanes(uv, textureLod, laneMask, [&](const Vector2& laneUV, float laneLod, float& r, float& g, float& b)
+		{
+			const ColorRGB sampled{ texture.Sample(laneUV, laneLod) };
+			r = sampled.r;
+			g = sampled.g;
+			b = sampled.b;
+		}
+	) };
+	return ColorPacket{ color.x, color.y, color.z };
+}
+
+//Shades a whole packet at once, lanes outside the mask are computed too but never sampled or written
+template<typename Shader>
+ColorPacket dae::Renderer::PixelShading(const Vertex_OutPacket& v, const FloatPacket& uvLod, uint32_t laneMask, const uint32_t* pClusterIndices) const
 {
 	const float lightIntensity{ 7.f };
 	const float kd{ 1.f };
 	const float shininess{ 25.f };
-	Vector3 sampledNormal{ v.normal };
-	const ColorRGB ambient{ 0.025f, 0.025f, 0.025f };
-	
-	if (m_ShouldRenderNormals)
-	{
-		const Vector3 binormal{ Vector3::Cross(v.normal, v.tangent) };
-		const Matrix tangentSpaceAxis{ v.tangent, binormal.Normalized(), v.normal, Vector3{0.f, 0.f, 0.f}};
-		sampledNormal = m_pNormalTexture->SampleNormal(v.uv);
-		sampledNormal = (2.f * sampledNormal) - Vector3{ 1.f, 1.f, 1.f };
-		sampledNormal = tangentSpaceAxis.TransformVector(sampledNormal);
-		sampledNormal.Normalize();
-	}
-	
-	const float observedArea{ std::max(Vector3::Dot(sampledNormal, -m_LightDirection), 0.f) };
-	const ColorRGB observedAreaColor{ observedArea, observedArea, observedArea };
-	switch (m_ShadingMode)
+	Vector3Packet sampledNormal{ v.normal };
+	const ColorPacket ambient{ ColorRGB{ 0.025f, 0.025f, 0.025f } };
+
+	if constexpr (Shader::useNormalMap)
 	{
-	case ShadingMode::Combined:
+		//The sampled normal is already signed and unit length, only the 3x3 TBN transform is left
+		//Normal and tangent arrive normalized, but they are no longer perpendicular once interpolated, so only their cross product needs it
+		const Vector3Packet binormal{ Vector3Packet::Cross(v.normal, v.tangent).Normalized() };
+		const FloatPacket normalLod{ GetTextureLod(uvLod, m_pNormalTexture->GetWidth(), m_pNormalTexture->GetHeight()) };
+		const Vector3Packet tangentNormal{ SampleLanes(v.uv, normalLod, laneMask, [&](const Vector2& laneUV, float laneLod, float& x, float& y, float& z)
+			{
+				const Vector3 sampled{ m_pNormalTexture->SampleNormal(laneUV, laneLod) };
+				x = sampled.x;
+				y = sampled.y;
+				z = sampled.z;
+			}
+		) };
+		sampledNormal = v.tangent * tangentNormal.x + binormal * tangentNormal.y + v.normal * tangentNormal.z;
+	}
+
+	//Material inputs are sampled once and shared by every light
+	//PBR reads the specular map as F0 and the glossiness map as one minus the roughness
+	constexpr bool isPBR{ Shader::shadingMode == ShadingMode::PBR };
+	constexpr bool usesDiffuse{ Shader::shadingMode == ShadingMode::Combined || Shader::shadingMode == ShadingMode::Diffuse || isPBR };
+	constexpr bool usesSpecular{ Shader::useSpecularMaps || isPBR };
+	ColorPacket diffuseColor{};
+	if constexpr (usesDiffuse) diffuseColor = SampleDiffuse(v.uv, laneMask, uvLod);
+	ColorPacket specularColor{};
+	FloatPacket exponent{};
+	FloatPacket roughness{ 0.5f };
+	if constexpr (isPBR) specularColor = ColorRGB{ 0.04f, 0.04f, 0.04f };
+	if constexpr (Shader::useSpecularMaps)
 	{
-		const ColorRGB diffuse{ dae::BRDF::Lambert(kd, m_pDiffuseTexture->Sample(v.uv)) * lightIntensity };
-		const ColorRGB specular{ BRDF::Phong(m_pSpecularTexture->Sample(v.uv), 1.f, m_pGlossinessTexture->Sample(v.uv).r * shininess,
-			m_LightDirection, -v.viewDirection, sampledNormal) };
-		return (diffuse  + specular + ambient) * observedArea;
+		specularColor = SampleColor(*m_pSpecularTexture, v.uv, uvLod, laneMask);
+		const FloatPacket glossiness{ SampleColor(*m_pGlossinessTexture, v.uv, uvLod, laneMask).r };
+		if constexpr (isPBR) roughness = Max(FloatPacket{ 1.f } - glossiness, 0.05f);
+		else exponent = glossiness * shininess;
 	}
-	case ShadingMode::ObservedArea:
+	const auto specular{ [&](const Vector3Packet& lightDirection)
+		{
+			if constexpr (isPBR) return BRDF::CookTorrance(specularColor, roughness, lightDirection, -v.viewDirection, sampledNormal);
+			else return BRDF::Phong<Shader::useFastSpecular>(specularColor, 1.f, exponent, lightDirection, -v.viewDirection, sampledNormal);
+		}
+	};
+
+	//Local lights of the pixel's cluster, lanes of a packet usually share one
+	//Lanes in other clusters are handled in further passes, each pass only adds to its own lanes
+	ColorPacket localIrradiance{};
+	ColorPacket localSpecular{};
+	if constexpr (Shader::useLocalLights)
+	{
+		for (uint32_t remainingLanes{ laneMask }; remainingLanes != 0;)
+		{
+			const uint32_t clusterIdx{ pClusterIndices[std::countr_zero(remainingLanes)] };
+			uint32_t clusterLanes{};
+			for (uint32_t lanes{ remainingLanes }; lanes != 0; lanes &= lanes - 1)
+			{
+				const int lane{ std::countr_zero(lanes) };
+				if (pClusterIndices[lane] == clusterIdx) clusterLanes |= 1u << lane;
+			}
+			remainingLanes &= ~clusterLanes;
+			const FloatPacket clusterLaneMask{ FloatPacket::FromMask(clusterLanes) };
+
+			for (const uint32_t lightIdx : m_LightClusters.GetLights(clusterIdx))
+			{
+				const Light& light{ m_Lights[lightIdx] };
+				const Vector3Packet toLight{ Vector3Packet{ light.position } - v.worldPosition };
+				const FloatPacket distanceSquared{ Vector3Packet::Dot(toLight, toLight) };
+				const Vector3Packet lightDirection{ toLight * (FloatPacket{ 1.f } / Sqrt(distanceSquared)) };
+
+				//Inverse square falloff, windowed so it reaches zero at the range
+				const FloatPacket rangeRatio{ distanceSquared * (1.f / (light.range * light.range)) };
+				const FloatPacket window{ Max(FloatPacket{ 1.f } - rangeRatio * rangeRatio, 0.f) };
+				FloatPacket attenuation{ window * window / (distanceSquared + 1.f) * light.intensity };
+				if (light.type == LightType::Spot)
+				{
+					const FloatPacket cosAngle{ -Vector3Packet::Dot(lightDirection, Vector3Packet{ light.direction }) };
+					const float invConeWidth{ 1.f / std::max(light.cosInnerAngle - light.cosOuterAngle, 1e-4f) };
+					const FloatPacket cone{ Min(Max((cosAngle - light.cosOuterAngle) * invConeWidth, 0.f), 1.f) };
+					attenuation = attenuation * cone * cone;
+				}
+
+				const FloatPacket incident{ (attenuation * Max(Vector3Packet::Dot(sampledNormal, lightDirection), 0.f)) & clusterLaneMask };
+				const ColorPacket radiance{ ColorPacket{ light.color } * incident };
+				localIrradiance += radiance;
+				if constexpr (usesSpecular) localSpecular += specular(-lightDirection) * radiance;
+			}
+		}
+	}
+
+	const FloatPacket observedArea{ Max(Vector3Packet::Dot(sampledNormal, -m_LightDirection), 0.f) };
+	//Only the direct part of the directional light is shadowed, the ambient term keeps shadowed surfaces readable
+	FloatPacket shadow{ 1.f };
+	if constexpr (Shader::useShadows) shadow = SampleShadow(v.worldPosition, v.normal);
+	if constexpr (Shader::shadingMode == ShadingMode::Combined)
 	{
-		return observedAreaColor;
+		const ColorPacket diffuse{ BRDF::Lambert(kd, diffuseColor) * lightIntensity };
+		ColorPacket color{};
+		if constexpr (Shader::useSpecularMaps) color = ((diffuse + specular(m_LightDirection)) * shadow + ambient) * observedArea;
+		else color = (diffuse * shadow + ambient) * observedArea;
+		if constexpr (Shader::useLocalLights) color += BRDF::Lambert(kd, diffuseColor) * localIrradiance + localSpecular;
+		return color;
 	}
-	case ShadingMode::Diffuse:
+	else if constexpr (Shader::shadingMode == ShadingMode::ObservedArea)
 	{
-		const ColorRGB diffuse{ BRDF::Lambert(kd, m_pDiffuseTexture->Sample(v.uv) * lightIntensity) };
-		return diffuse * observedAreaColor;
+		return ColorPacket{ observedArea, observedArea, observedArea };
 	}
-	case ShadingMode::Specular:
+	else if constexpr (Shader::shadingMode == ShadingMode::Diffuse)
 	{
-		const ColorRGB specular{ BRDF::Phong(m_pSpecularTexture->Sample(v.uv), 1.f, m_pGlossinessTexture->Sample(v.uv).r * shininess, 
-			m_LightDirection, -v.viewDirection, sampledNormal) };
-		return specular *observedAreaColor;
+		ColorPacket color{ BRDF::Lambert(kd, diffuseColor * lightIntensity) * (observedArea * shadow) };
+		if constexpr (Shader::useLocalLights) color += BRDF::Lambert(kd, diffuseColor) * localIrradiance;
+		return color;
 	}
-	default:
-		return ColorRGB{};
+	else if constexpr (isPBR)
+	{
+		//Dielectrics lose to the diffuse term what they reflect, metals have no diffuse term left
+		const FloatPacket diffuseWeight{ FloatPacket{ 1.f } - Max(specularColor.r, Max(specularColor.g, specularColor.b)) };
+		const ColorPacket diffuse{ BRDF::Lambert(kd, diffuseColor * diffuseWeight) };
+		ColorPacket color{ (diffuse + specular(m_LightDirection)) * (observedArea * shadow * lightIntensity) };
+		if constexpr (Shader::useLocalLights) color += diffuse * localIrradiance + localSpecular;
+
+		//Split sum, the prefiltered environment around the reflection times the BRDF integrated for this view angle and roughness
+		FloatPacket scale{}, bias{};
+		m_ImageBasedLighting.SampleBRDF(Max(Vector3Packet::Dot(sampledNormal, -v.viewDirection), 0.f), roughness, scale, bias);
+		const ColorPacket environmentSpecular{ m_ImageBasedLighting.SampleSpecular(Vector3Packet::Reflect(v.viewDirection, sampledNormal), roughness) };
+		color += diffuse * m_ImageBasedLighting.SampleIrradiance(sampledNormal);
+		color += environmentSpecular * ColorPacket{ specularColor.r * scale + bias, specularColor.g * scale + bias, specularColor.b * scale + bias };
+		return color;
+	}
+	else if constexpr (Shader::useSpecularMaps)
+	{
+		return specular(m_LightDirection) * (observedArea * shadow) + localSpecular;
+	}
+	else
+	{
+		return ColorPacket{};
 	}
 }
 
@@ -1,10 +1,15 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "AssetManager.h"
 #include "Camera.h"
 #include "DataTypes.h"
+#include "ImageBasedLighting.h"
+#include "LightClusters.h"
 
 struct SDL_Window;
 struct SDL_Surface;
@@ -12,6 +17,7 @@ struct SDL_Surface;
 namespace dae
 {
 	class Texture;
+	class VirtualTexture;
 	struct Mesh;
 	struct Vertex;
 	class Timer;
@@ -34,6 +40,8 @@ namespace dae
 		void ToggleRotation();
 		void ToggleNormalMap();
 		void CycleShadingMode();
+		void ToggleFastSpecular();
+		void ToggleVariableRateShading();
 
 		bool SaveBufferToImage() const;
 
@@ -50,13 +58,50 @@ namespace dae
 		float m_AspectRatio{};
 		float* m_pDepthBufferPixels{};
 		Vector3 m_LightDirection{ 0.577f, -0.577f, 0.577f };
-		Texture* m_pDiffuseTexture{ nullptr };
-		Texture* m_pNormalTexture{ nullptr };
-		Texture* m_pSpecularTexture{ nullptr };
-		Texture* m_pGlossinessTexture{ nullptr };
+		//Adds the ring of point lights and the spot light around the vehicle, without them no draw uses the clustered light loop
+		const bool m_UseLocalLights{ true };
+		std::vector<Light> m_Lights{};
+		LightClusters m_LightClusters{};
+		//Split sum tables of the sky for the PBR shading mode, built once at startup
+		ImageBasedLighting m_ImageBasedLighting{};
+
+		//Shadows of the directional light, a depth only map that is refit around the camera every frame
+		const bool m_UseShadows{ true };
+		const int m_ShadowMapSize{ 1024 };
+		//Only this much of the view receives shadows, a shorter distance keeps the texels small
+		const float m_ShadowDistance{ 80.f };
+		std::vector<float> m_ShadowMap{};
+		std::vector<Vector3> m_ShadowVertices{};
+		//World space to shadow map texels, with the depth from 0 to 1 in z
+		Matrix m_ShadowMatrix{};
+		float m_ShadowTexelSize{};
+		AssetManager m_AssetManager{};
+		std::shared_ptr<Texture> m_pDiffuseTexture{ nullptr };
+		std::shared_ptr<Texture> m_pNormalTexture{ nullptr };
+		std::shared_ptr<Texture> m_pSpecularTexture{ nullptr };
+		std::shared_ptr<Texture> m_pGlossinessTexture{ nullptr };
+		//Streams the diffuse map page by page instead of keeping it resident, meant for atlases larger than RAM
+		std::unique_ptr<VirtualTexture> m_pVirtualDiffuseTexture{ nullptr };
 		std::vector<Mesh> m_Meshes{};
 
+		//Scene slots that still show a placeholder box, swapped for the real mesh once the asset manager publishes it
+		struct StreamingMesh
+		{
+			std::string path{};
+			size_t meshIdx{};
+		};
+		std::vector<StreamingMesh> m_StreamingMeshes{};
+		TextureFormat m_ColorFormat{};
+		TextureFormat m_GlossFormat{};
+		TextureFormat m_NormalFormat{};
+
 		const float m_RotationSpeed{ 1.f };
+		const bool m_UseCompressedTextures{ true };
+		const bool m_UseVirtualTexturing{ false };
+		//Rejects whole meshlets that face away from the camera or lie outside the frustum before any triangle setup
+		const bool m_UseClusterCulling{ true };
+		//Specular pow through the polynomial exp2/log2 instead of powf per pixel, off renders the exact reference
+		bool m_UseFastSpecular{ true };
 		bool m_ShouldRotate{ true };
 
 		bool m_ShouldRenderNormals{ true };
@@ -76,6 +121,8 @@ namespace dae
 			ObservedArea,
 			Diffuse,
 			Specular,
+			//Cook-Torrance under the directional light, the local lights and the environment
+			PBR,
 			//Declare modes above
 			COUNT
 		};
@@ -84,15 +131,144 @@ namespace dae
 		RenderMode m_RenderMode{ RenderMode::FinalColor };
 		ShadingMode m_ShadingMode{ ShadingMode::Combined };
 
+		//Pixels that share one shading evaluation, coverage and depth are still tested per pixel
+		enum class ShadingRate : uint8_t
+		{
+			Rate1x1,
+			Rate2x1,
+			Rate2x2,
+			Rate4x4
+		};
+
+		enum class ShadingRateSource
+		{
+			//Every tile uses m_StaticShadingRate
+			Static,
+			//Flat tiles of the previous frame shade coarser, tiles with edges or detail keep the full rate
+			LuminanceVariance,
+			//The rate drops towards the borders of the screen
+			ScreenCenter
+		};
+
+		//Variable rate shading, the screen is split in tiles that each get a shading rate before the frame is rasterized
+		bool m_UseVariableRateShading{ true };
+		const ShadingRateSource m_ShadingRateSource{ ShadingRateSource::LuminanceVariance };
+		const ShadingRate m_StaticShadingRate{ ShadingRate::Rate2x2 };
+		static constexpr int ShadingRateTileSize{ 16 };
+		int m_ShadingRateTilesX{};
+		std::vector<ShadingRate> m_ShadingRates{};
+		//Luminance source only, the rate each tile settled on and the tile row that is shaded at the full rate this frame
+		std::vector<ShadingRate> m_MeasuredShadingRates{};
+		int m_ShadingRateReferenceRow{};
+
+		//A 4x4 shading cell spans two rows of quads, the first packet that reaches it takes its sample and the later ones join that sample
+		//sample is the cell's slot in the batch until the batch is shaded, from then on the color is kept here
+		struct CoarseCell
+		{
+			int cellX;
+			int cellY;
+			int sample;
+			float red;
+			float green;
+			float blue;
+		};
+		//Coarse cells each contribute one sample, gathered across quads, packets and triangles until a full packet can be shaded
+		//The shaded colors are broadcast to every pixel of their cells afterwards
+		struct CoarseShadingBatch
+		{
+			//The Vertex_OutPacket components in declaration order, one lane per sample
+			//Lanes past numSamples are shaded as well, they start out zero instead of undefined
+			float components[14][PacketWidth]{};
+			float uvLods[PacketWidth]{};
+			uint32_t clusterIndices[PacketWidth]{};
+			CoarseCell* pCells[PacketWidth];
+			int numSamples{};
+
+			//Pixels waiting for the color of a sample, the depth they wrote tells whether a nearer triangle took the pixel meanwhile
+			struct PendingPixel
+			{
+				int pixelIdx;
+				int sample;
+				float depth;
+			};
+			//No sample covers more than a 4x4 cell
+			PendingPixel pixels[PacketWidth * 16];
+			int numPixels{};
+		};
+
+		//Every combination of modes the pixel loop can run in, each one is compiled into a raster loop of its own
+		//The modes are looked at once per draw, the loop itself only sees constants
+		template<RenderMode Mode, ShadingMode Shading = ShadingMode::Combined, bool NormalMapping = false, bool SpecularMapping = false, bool FastSpecular = true,
+			bool LocalLights = false, bool Shadows = false>
+		struct ShaderPermutation
+		{
+			static constexpr RenderMode renderMode{ Mode };
+			static constexpr ShadingMode shadingMode{ Shading };
+			static constexpr bool useNormalMap{ NormalMapping };
+			static constexpr bool useSpecularMaps{ SpecularMapping };
+			static constexpr bool useFastSpecular{ FastSpecular };
+			static constexpr bool useLocalLights{ LocalLights };
+			static constexpr bool useShadows{ Shadows };
+
+			//The attributes PixelShading reads, the rasterizer sets up and interpolates nothing else
+			static constexpr uint32_t GetVaryings()
+			{
+				if (Mode == RenderMode::DepthBuffer) return Varyings::None;
+
+				uint32_t varyings{ Varyings::Normal };
+				if (NormalMapping) varyings |= Varyings::UV | Varyings::Tangent;
+				if (Shading == ShadingMode::Combined || Shading == ShadingMode::Diffuse) varyings |= Varyings::UV;
+				if (Shading == ShadingMode::PBR) varyings |= Varyings::UV | Varyings::ViewDirection;
+				if (Shading == ShadingMode::Specular && !SpecularMapping) return Varyings::None;
+				if (SpecularMapping) varyings |= Varyings::UV | Varyings::ViewDirection;
+				if (LocalLights || Shadows) varyings |= Varyings::WorldPosition;
+				return varyings;
+			}
+			static constexpr uint32_t varyings{ GetVaryings() };
+		};
+
+		void AddStreamingMesh(const std::string& path, const Matrix& worldMatrix);
+		void UpdateStreaming();
+
 		//Function that transforms the vertices from the mesh from World space to Screen space
 		void VertexTransformationFunction(const std::vector<Vertex>& vertices_in, std::vector<Vertex>& vertices_out) const; //W1 Version
 		void VertexTransformationFunction(Mesh& mesh) const;
-		void RenderMeshTriangle(const Mesh& mesh, const std::vector<Vector2>& screenVertices, uint32_t vertIdxbool, bool swapVertices = false);
+		bool IsMeshletVisible(const Mesh& mesh, const Meshlet& meshlet) const;
+		template<typename Draw>
+		void DispatchShaderPermutation(const Draw& draw) const;
+		template<typename IndexType, typename Shader>
+		void RenderMesh(const Mesh& mesh, const std::vector<Vector2>& screenVertices);
+		template<typename IndexType, typename Shader>
+		void RenderMeshList(const Mesh& mesh, const std::vector<Vector2>& screenVertices, uint32_t firstIndex, uint32_t numIndices);
+		template<typename IndexType, typename Shader>
+		void RenderMeshStrip(const Mesh& mesh, const std::vector<Vector2>& screenVertices, uint32_t firstIndex, uint32_t numIndices);
+		//pInvPosW holds 1/w of the three corners in the same order as the indices, strips carry it over instead of dividing again
+		//Without it the reciprocals are computed here
+		template<typename Shader>
+		void RenderMeshTriangle(const Mesh& mesh, const std::vector<Vector2>& screenVertices, uint32_t vertIdx0, uint32_t vertIdx1, uint32_t vertIdx2,
+			CoarseShadingBatch& coarseShading, const float* pInvPosW = nullptr);
+		//Shades the gathered samples and writes their colors to the pixels still waiting for them
+		template<typename Shader>
+		void FlushCoarseShading(CoarseShadingBatch& batch);
 		void Render_W1();
 		//void Render_W2();
 		void Render_W3();
+		void RenderShadowMap();
+		//Has to run before the buffers are cleared, the luminance source reads the previous frame
+		void UpdateShadingRates();
+		ShadingRate GetShadingRate(int x, int y) const
+		{
+			return m_ShadingRates[(y / ShadingRateTileSize) * m_ShadingRateTilesX + x / ShadingRateTileSize];
+		}
+		//Fraction of a 3x3 texel neighbourhood the directional light reaches, 1 outside the shadow map
+		FloatPacket SampleShadow(const Vector3Packet& worldPosition, const Vector3Packet& normal) const;
 
-		ColorRGB PixelShading(const Vertex_Out& v);
+		//uvLod is the log2 of the uv footprint of each lane, the rasterizer takes it from the quad derivatives since gathered coarse samples no longer sit in quads
+		template<typename Shader>
+		ColorPacket PixelShading(const Vertex_OutPacket& v, const FloatPacket& uvLod, uint32_t laneMask, const uint32_t* pClusterIndices = nullptr) const;
+		ColorRGB SampleDiffuse(const Vector2& uv, float textureLod) const;
+		//uvLod is the log2 of the uv footprint of each pixel, the texture size is added in here
+		ColorPacket SampleDiffuse(const Vector2Packet& uv, uint32_t laneMask, const FloatPacket& uvLod) const;
 		//std::vector<Vector2> ClipPolygonToFrustrum()
 	};
 }
@@ -0,0 +1,190 @@
+#include "Stripifier.h"
+#include "DataTypes.h"
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <unordered_map>
+
+namespace dae
+{
+	namespace Stripifier
+	{
+		using Triangle = std::array<uint32_t, 3>;
+
+		void WeldVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+		{
+			//Everything in front of the tangent takes part in the comparison, the tangent itself is rebuilt from the merged corners
+			constexpr size_t keySize{ offsetof(Vertex, tangent) };
+
+			std::vector<Vertex> weldedVertices{};
+			weldedVertices.reserve(vertices.size());
+			std::vector<uint32_t> remap(vertices.size());
+			std::unordered_map<std::string_view, uint32_t> vertexLookup{};
+			vertexLookup.reserve(vertices.size());
+			for (uint32_t vertIdx{}; vertIdx < static_cast<uint32_t>(vertices.size()); ++vertIdx)
+			{
+				const std::string_view key{ reinterpret_cast<const char*>(&vertices[vertIdx]), keySize };
+				const auto [it, isNew] { vertexLookup.try_emplace(key, static_cast<uint32_t>(weldedVertices.size())) };
+				if (isNew) weldedVertices.push_back(vertices[vertIdx]);
+				else weldedVertices[it->second].tangent += vertices[vertIdx].tangent;
+				remap[vertIdx] = it->second;
+			}
+
+			for (Vertex& vertex : weldedVertices)
+			{
+				vertex.tangent = Vector3::Reject(vertex.tangent, vertex.normal).Normalized();
+			}
+			for (uint32_t& index : indices)
+			{
+				index = remap[index];
+			}
+			//The lookup keys point into the old vertices, so they are only replaced at the very end
+			vertexLookup.clear();
+			vertices.swap(weldedVertices);
+		}
+
+		static uint64_t GetEdgeKey(uint32_t index0, uint32_t index1)
+		{
+			return (static_cast<uint64_t>(std::min(index0, index1)) << 32) | std::max(index0, index1);
+		}
+
+		static bool IsSameWinding(const Triangle& triangle, uint32_t index0, uint32_t index1, uint32_t index2)
+		{
+			for (uint32_t rotation{}; rotation < 3; ++rotation)
+			{
+				if (triangle[rotation] == index0 && triangle[(rotation + 1) % 3] == index1 && triangle[(rotation + 2) % 3] == index2) return true;
+			}
+			return false;
+		}
+
+		//Greedily strips the triangles of one range, every strip after the first is preceded by a restart
+		static void StripifyRange(const std::vector<Triangle>& triangles, std::vector<uint32_t>& strip)
+		{
+			const uint32_t numTriangles{ static_cast<uint32_t>(triangles.size()) };
+
+			std::vector<std::pair<uint64_t, uint32_t>> edges{};
+			edges.reserve(numTriangles * 3);
+			for (uint32_t triIdx{}; triIdx < numTriangles; ++triIdx)
+			{
+				for (uint32_t cornerIdx{}; cornerIdx < 3; ++cornerIdx)
+				{
+					edges.emplace_back(GetEdgeKey(triangles[triIdx][cornerIdx], triangles[triIdx][(cornerIdx + 1) % 3]), triIdx);
+				}
+			}
+			std::sort(edges.begin(), edges.end());
+
+			std::vector<bool> isUsed(numTriangles);
+			std::vector<uint32_t> walkStamps(numTriangles);
+			uint32_t walkStamp{};
+
+			//Follows the strip from the start triangle and returns the vertices and triangles it passes, triangles are only marked for this walk
+			std::vector<uint32_t> walk{};
+			std::vector<uint32_t> walkTriangles{};
+			const auto walkStrip{ [&](uint32_t startIdx, uint32_t rotation)
+				{
+					++walkStamp;
+					walk.clear();
+					walkTriangles.clear();
+					for (uint32_t cornerIdx{}; cornerIdx < 3; ++cornerIdx) walk.push_back(triangles[startIdx][(rotation + cornerIdx) % 3]);
+					walkStamps[startIdx] = walkStamp;
+					walkTriangles.push_back(startIdx);
+
+					while (true)
+					{
+						const uint32_t index0{ walk[walk.size() - 2] };
+						const uint32_t index1{ walk[walk.size() - 1] };
+						//The assembler swaps the outer vertices of odd triangles, the next triangle has to wind correctly after that
+						const bool isOdd{ (walk.size() - 2) % 2 == 1 };
+
+						uint32_t nextIdx{ numTriangles };
+						const auto range{ std::equal_range(edges.begin(), edges.end(), std::make_pair(GetEdgeKey(index0, index1), 0u),
+							[](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; }) };
+						for (auto it{ range.first }; it != range.second && nextIdx == numTriangles; ++it)
+						{
+							const uint32_t triIdx{ it->second };
+							if (isUsed[triIdx] || walkStamps[triIdx] == walkStamp) continue;
+
+							const Triangle& triangle{ triangles[triIdx] };
+							const uint32_t index2{ triangle[0] + triangle[1] + triangle[2] - index0 - index1 };
+							const bool fits{ isOdd ? IsSameWinding(triangle, index2, index1, index0) : IsSameWinding(triangle, index0, index1, index2) };
+							if (fits) nextIdx = triIdx;
+						}
+						if (nextIdx == numTriangles) return;
+
+						const Triangle& next{ triangles[nextIdx] };
+						walk.push_back(next[0] + next[1] + next[2] - index0 - index1);
+						walkStamps[nextIdx] = walkStamp;
+						walkTriangles.push_back(nextIdx);
+					}
+				}
+			};
+
+			for (uint32_t startIdx{}; startIdx < numTriangles; ++startIdx)
+			{
+				if (isUsed[startIdx]) continue;
+
+				//Each rotation of the start triangle leaves along a different edge, keep the longest strip
+				uint32_t bestRotation{};
+				size_t bestLength{};
+				for (uint32_t rotation{}; rotation < 3; ++rotation)
+				{
+					walkStrip(startIdx, rotation);
+					if (walk.size() > bestLength)
+					{
+						bestLength = walk.size();
+						bestRotation = rotation;
+					}
+				}
+				walkStrip(startIdx, bestRotation);
+				for (const uint32_t triIdx : walkTriangles)
+				{
+					isUsed[triIdx] = true;
+				}
+
+				if (!strip.empty()) strip.push_back(PrimitiveRestartIndex<uint32_t>);
+				strip.insert(strip.end(), walk.begin(), walk.end());
+			}
+		}
+
+		std::vector<uint32_t> Build(const std::vector<uint32_t>& indices, std::vector<Meshlet>& meshlets)
+		{
+			std::vector<uint32_t> strip{};
+			strip.reserve(indices.size());
+
+			std::vector<Triangle> triangles{};
+			const auto gatherTriangles{ [&](uint32_t firstIndex, uint32_t numIndices)
+				{
+					triangles.clear();
+					for (uint32_t idx{ firstIndex }; idx + 2 < firstIndex + numIndices; idx += 3)
+					{
+						//Degenerate triangles are never drawn and would break the edge walk
+						if (indices[idx] == indices[idx + 1] || indices[idx + 1] == indices[idx + 2] || indices[idx + 2] == indices[idx]) continue;
+						triangles.push_back(Triangle{ indices[idx], indices[idx + 1], indices[idx + 2] });
+					}
+				}
+			};
+
+			if (meshlets.empty())
+			{
+				gatherTriangles(0, static_cast<uint32_t>(indices.size()));
+				StripifyRange(triangles, strip);
+				return strip;
+			}
+
+			for (Meshlet& meshlet : meshlets)
+			{
+				gatherTriangles(meshlet.firstIndex, meshlet.numIndices);
+
+				//The restart in front of a meshlet belongs to neither range, every meshlet range starts on a fresh strip
+				std::vector<uint32_t> meshletStrip{};
+				StripifyRange(triangles, meshletStrip);
+				if (!strip.empty() && !meshletStrip.empty()) strip.push_back(PrimitiveRestartIndex<uint32_t>);
+				meshlet.firstIndex = static_cast<uint32_t>(strip.size());
+				meshlet.numIndices = static_cast<uint32_t>(meshletStrip.size());
+				strip.insert(strip.end(), meshletStrip.begin(), meshletStrip.end());
+			}
+			return strip;
+		}
+	}
+}
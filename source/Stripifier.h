@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace dae
+{
+	struct Vertex;
+	struct Meshlet;
+
+	namespace Stripifier
+	{
+		//Merges face corners with the same position, color, uv and normal, their tangents are averaged
+		//Without this no two OBJ triangles share an index and there is nothing to strip
+		void WeldVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+		//Converts a triangle list into strips separated by the primitive restart index
+		//Every meshlet range is stripified on its own and rewritten to its range in the returned strip indices
+		std::vector<uint32_t> Build(const std::vector<uint32_t>& indices, std::vector<Meshlet>& meshlets);
+	}
+}
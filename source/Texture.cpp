@@ -1,80 +1,738 @@
 #include "Texture.h"
 #include "Vector2.h"
+#include "MappedFile.h"
+#include "Utils.h"
 #include <SDL_image.h>
 
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+//Keep a few decoded blocks per thread, neighbouring pixels mostly hit the same 4x4 block
+#define BC_BLOCK_CACHE
+//Store the decoded (and compressed) mip chain next to the source image and map it on the next launch
+#define USE_TEXTURE_CACHE
+
 namespace dae
 {
-	Texture::Texture(SDL_Surface* pSurface) :
-		m_pSurface{ pSurface },
-		m_pSurfacePixels{ (uint32_t*)pSurface->pixels }
+	namespace BlockCompression
 	{
+		constexpr int BlockDimension{ 4 };
+		constexpr int TexelsPerBlock{ BlockDimension * BlockDimension };
+
+		inline uint16_t PackRGB565(uint8_t r, uint8_t g, uint8_t b)
+		{
+			return static_cast<uint16_t>(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+		}
+
+		inline void UnpackRGB565(uint16_t color, int& r, int& g, int& b)
+		{
+			r = (color >> 11) & 31;
+			g = (color >> 5) & 63;
+			b = color & 31;
+			r = (r << 3) | (r >> 2);
+			g = (g << 2) | (g >> 4);
+			b = (b << 3) | (b >> 2);
+		}
+
+		//Bounding box endpoints, inset a bit to reduce the error of the extremes
+		static void EncodeBC1(const uint8_t texels[TexelsPerBlock][3], uint8_t* pBlock)
+		{
+			int min[3]{ 255, 255, 255 };
+			int max[3]{ 0, 0, 0 };
+			for (int texelIdx{}; texelIdx < TexelsPerBlock; ++texelIdx)
+			{
+				for (int channel{}; channel < 3; ++channel)
+				{
+					min[channel] = std::min(min[channel], static_cast<int>(texels[texelIdx][channel]));
+					max[channel] = std::max(max[channel], static_cast<int>(texels[texelIdx][channel]));
+				}
+			}
+			for (int channel{}; channel < 3; ++channel)
+			{
+				const int inset{ (max[channel] - min[channel]) >> 4 };
+				min[channel] += inset;
+				max[channel] -= inset;
+			}
+
+			uint16_t color0{ PackRGB565(static_cast<uint8_t>(max[0]), static_cast<uint8_t>(max[1]), static_cast<uint8_t>(max[2])) };
+			uint16_t color1{ PackRGB565(static_cast<uint8_t>(min[0]), static_cast<uint8_t>(min[1]), static_cast<uint8_t>(min[2])) };
+			if (color0 < color1) std::swap(color0, color1);
+
+			uint32_t indices{};
+			if (color0 != color1)
+			{
+				//color0 > color1 selects the 4 color mode
+				int palette[4][3]{};
+				UnpackRGB565(color0, palette[0][0], palette[0][1], palette[0][2]);
+				UnpackRGB565(color1, palette[1][0], palette[1][1], palette[1][2]);
+				for (int channel{}; channel < 3; ++channel)
+				{
+					palette[2][channel] = (2 * palette[0][channel] + palette[1][channel]) / 3;
+					palette[3][channel] = (palette[0][channel] + 2 * palette[1][channel]) / 3;
+				}
+
+				for (int texelIdx{}; texelIdx < TexelsPerBlock; ++texelIdx)
+				{
+					int bestIdx{};
+					int bestDistance{ INT_MAX };
+					for (int paletteIdx{}; paletteIdx < 4; ++paletteIdx)
+					{
+						int distance{};
+						for (int channel{}; channel < 3; ++channel)
+						{
+							const int delta{ texels[texelIdx][channel] - palette[paletteIdx][channel] };
+							distance += delta * delta;
+						}
+						if (distance < bestDistance)
+						{
+							bestDistance = distance;
+							bestIdx = paletteIdx;
+						}
+					}
+					indices |= static_cast<uint32_t>(bestIdx) << (2 * texelIdx);
+				}
+			}
+
+			std::memcpy(pBlock, &color0, sizeof(color0));
+			std::memcpy(pBlock + 2, &color1, sizeof(color1));
+			std::memcpy(pBlock + 4, &indices, sizeof(indices));
+		}
+
+		static void EncodeBC4(const uint8_t values[TexelsPerBlock], uint8_t* pBlock)
+		{
+			int min{ 255 };
+			int max{ 0 };
+			for (int texelIdx{}; texelIdx < TexelsPerBlock; ++texelIdx)
+			{
+				min = std::min(min, static_cast<int>(values[texelIdx]));
+				max = std::max(max, static_cast<int>(values[texelIdx]));
+			}
+
+			uint64_t indices{};
+			if (max != min)
+			{
+				//endpoint0 > endpoint1 selects the 8 value mode
+				int palette[8]{ max, min };
+				for (int paletteIdx{ 2 }; paletteIdx < 8; ++paletteIdx)
+				{
+					palette[paletteIdx] = ((8 - paletteIdx) * max + (paletteIdx - 1) * min) / 7;
+				}
+
+				for (int texelIdx{}; texelIdx < TexelsPerBlock; ++texelIdx)
+				{
+					int bestIdx{};
+					int bestDistance{ INT_MAX };
+					for (int paletteIdx{}; paletteIdx < 8; ++paletteIdx)
+					{
+						const int distance{ std::abs(values[texelIdx] - palette[paletteIdx]) };
+						if (distance < bestDistance)
+						{
+							bestDistance = distance;
+							bestIdx = paletteIdx;
+						}
+					}
+					indices |= static_cast<uint64_t>(bestIdx) << (3 * texelIdx);
+				}
+			}
+
+			pBlock[0] = static_cast<uint8_t>(max);
+			pBlock[1] = static_cast<uint8_t>(min);
+			std::memcpy(pBlock + 2, &indices, 6);
+		}
+
+		inline void DecodeBC1(const uint8_t* pBlock, int texelIdx, uint8_t& r, uint8_t& g, uint8_t& b)
+		{
+			uint16_t color0{}, color1{};
+			uint32_t indices{};
+			std::memcpy(&color0, pBlock, sizeof(color0));
+			std::memcpy(&color1, pBlock + 2, sizeof(color1));
+			std::memcpy(&indices, pBlock + 4, sizeof(indices));
+
+			int r0, g0, b0, r1, g1, b1;
+			UnpackRGB565(color0, r0, g0, b0);
+			UnpackRGB565(color1, r1, g1, b1);
+
+			switch ((indices >> (2 * texelIdx)) & 3)
+			{
+			case 0:
+				r = static_cast<uint8_t>(r0), g = static_cast<uint8_t>(g0), b = static_cast<uint8_t>(b0);
+				break;
+			case 1:
+				r = static_cast<uint8_t>(r1), g = static_cast<uint8_t>(g1), b = static_cast<uint8_t>(b1);
+				break;
+			case 2:
+				if (color0 > color1)
+				{
+					r = static_cast<uint8_t>((2 * r0 + r1) / 3), g = static_cast<uint8_t>((2 * g0 + g1) / 3), b = static_cast<uint8_t>((2 * b0 + b1) / 3);
+				}
+				else
+				{
+					r = static_cast<uint8_t>((r0 + r1) / 2), g = static_cast<uint8_t>((g0 + g1) / 2), b = static_cast<uint8_t>((b0 + b1) / 2);
+				}
+				break;
+			case 3:
+				if (color0 > color1)
+				{
+					r = static_cast<uint8_t>((r0 + 2 * r1) / 3), g = static_cast<uint8_t>((g0 + 2 * g1) / 3), b = static_cast<uint8_t>((b0 + 2 * b1) / 3);
+				}
+				else
+				{
+					r = g = b = 0;
+				}
+				break;
+			}
+		}
+
+		inline uint8_t DecodeBC4(const uint8_t* pBlock, int texelIdx)
+		{
+			const int value0{ pBlock[0] };
+			const int value1{ pBlock[1] };
+			uint64_t indices{};
+			std::memcpy(&indices, pBlock + 2, 6);
+
+			const int paletteIdx{ static_cast<int>((indices >> (3 * texelIdx)) & 7) };
+			if (paletteIdx == 0) return static_cast<uint8_t>(value0);
+			if (paletteIdx == 1) return static_cast<uint8_t>(value1);
+			if (value0 > value1) return static_cast<uint8_t>(((8 - paletteIdx) * value0 + (paletteIdx - 1) * value1) / 7);
+			if (paletteIdx == 6) return 0;
+			if (paletteIdx == 7) return 255;
+			return static_cast<uint8_t>(((6 - paletteIdx) * value0 + (paletteIdx - 1) * value1) / 5);
+		}
+
+		//BC5 only stores the x and y of the normal, z is always positive in tangent space
+		//The unit normal is stored signed like NormalSNORM8, so the block cache holds texels that are ready to shade
+		inline void ReconstructNormal(uint8_t x, uint8_t y, uint8_t& r, uint8_t& g, uint8_t& b)
+		{
+			float nx{ x * (2.f / 255.f) - 1.f };
+			float ny{ y * (2.f / 255.f) - 1.f };
+			const float sqrLength{ nx * nx + ny * ny };
+			if (sqrLength > 1.f)
+			{
+				const float invLength{ 1.f / sqrtf(sqrLength) };
+				nx *= invLength;
+				ny *= invLength;
+			}
+			const float nz{ sqrtf(std::max(1.f - nx * nx - ny * ny, 0.f)) };
+			r = static_cast<uint8_t>(static_cast<int8_t>(std::lround(nx * 127.f)));
+			g = static_cast<uint8_t>(static_cast<int8_t>(std::lround(ny * 127.f)));
+			b = static_cast<uint8_t>(static_cast<int8_t>(std::lround(nz * 127.f)));
+		}
+
+		inline void DecodeTexel(TextureFormat format, const uint8_t* pBlock, int texelIdx, uint8_t& r, uint8_t& g, uint8_t& b)
+		{
+			switch (format)
+			{
+			case TextureFormat::BC1:
+				DecodeBC1(pBlock, texelIdx, r, g, b);
+				break;
+			case TextureFormat::BC4:
+				r = g = b = DecodeBC4(pBlock, texelIdx);
+				break;
+			case TextureFormat::BC5:
+				ReconstructNormal(DecodeBC4(pBlock, texelIdx), DecodeBC4(pBlock + 8, texelIdx), r, g, b);
+				break;
+			default:
+				r = g = b = 0;
+				break;
+			}
+		}
+
+		inline size_t GetBlockSize(TextureFormat format)
+		{
+			switch (format)
+			{
+			case TextureFormat::BC1:
+			case TextureFormat::BC4:
+				return 8;
+			case TextureFormat::BC5:
+				return 16;
+			default:
+				return 0;
+			}
+		}
+
+#ifdef BC_BLOCK_CACHE
+		struct DecodedBlock
+		{
+			uint32_t textureId{};
+			uint32_t levelIdx{};
+			uint32_t blockIdx{};
+			uint8_t texels[TexelsPerBlock][3]{};
+		};
+
+		constexpr uint32_t BlockCacheSize{ 64 };
+		thread_local std::array<DecodedBlock, BlockCacheSize> g_BlockCache{};
+#endif
 	}
 
-	Texture::~Texture()
+	namespace TextureCache
 	{
-		if (m_pSurface)
+		constexpr uint32_t Magic{ 0x43585444 }; //"DTXC"
+		constexpr uint32_t Version{ 1 };
+		constexpr size_t DataAlignment{ 16 };
+
+		struct Header
 		{
-			SDL_FreeSurface(m_pSurface);
-			m_pSurface = nullptr;
+			uint32_t magic{ Magic };
+			uint32_t version{ Version };
+			uint32_t format{};
+			uint32_t numLevels{};
+			int32_t width{};
+			int32_t height{};
+			uint64_t sourceSize{};
+			int64_t sourceTimestamp{};
+			uint64_t sourceHash{};
+		};
+
+		struct LevelDesc
+		{
+			uint64_t offset{};
+			uint64_t size{};
+			int32_t width{};
+			int32_t height{};
+		};
+
+		inline std::string GetCachePath(const std::string& path, TextureFormat format)
+		{
+			constexpr const char* formatNames[]{ "rgba8", "bc1", "bc4", "bc5", "snorm8" };
+			return path + '.' + formatNames[static_cast<int>(format)] + ".tcache";
 		}
 	}
 
-	Texture* Texture::LoadFromFile(const std::string& path)
+	static std::atomic<uint32_t> g_NextTextureId{ 1 };
+
+	Texture::Texture() :
+		m_Id{ g_NextTextureId++ }
 	{
-		//TODO
-		//Load SDL_Surface using IMG_LOAD
-		//Create & Return a new Texture Object (using SDL_Surface)
-		SDL_Surface* pSurface = IMG_Load(path.c_str());
-		Texture* loadedTexture{ new Texture(pSurface) };
+	}
+
+	Texture::~Texture() = default;
+
+	Texture* Texture::LoadFromFile(const std::string& path, TextureFormat format)
+	{
+#ifdef USE_TEXTURE_CACHE
+		const std::string cachePath{ TextureCache::GetCachePath(path, format) };
+		if (Texture* pCachedTexture{ LoadFromCache(cachePath, path, format) })
+		{
+			return pCachedTexture;
+		}
+#endif
+
+		//Load SDL_Surface using IMG_LOAD, convert it to a known byte order so we can copy the texels as is
+		SDL_Surface* pLoadedSurface = IMG_Load(path.c_str());
+		if (!pLoadedSurface) return nullptr;
+		SDL_Surface* pSurface{ SDL_ConvertSurfaceFormat(pLoadedSurface, SDL_PIXELFORMAT_RGBA32, 0) };
+		SDL_FreeSurface(pLoadedSurface);
+		if (!pSurface) return nullptr;
 
+		std::vector<uint8_t> rgbaTexels(static_cast<size_t>(pSurface->w) * pSurface->h * 4);
+		for (int y{}; y < pSurface->h; ++y)
+		{
+			std::memcpy(rgbaTexels.data() + static_cast<size_t>(y) * pSurface->w * 4,
+				static_cast<const uint8_t*>(pSurface->pixels) + static_cast<size_t>(y) * pSurface->pitch, static_cast<size_t>(pSurface->w) * 4);
+		}
+
+		Texture* loadedTexture{ new Texture() };
+		loadedTexture->m_Format = format;
+		loadedTexture->m_Width = pSurface->w;
+		loadedTexture->m_Height = pSurface->h;
+		SDL_FreeSurface(pSurface);
+
+		loadedTexture->BuildLevels(std::move(rgbaTexels));
+
+#ifdef USE_TEXTURE_CACHE
+		loadedTexture->WriteToCache(cachePath, path);
+#endif
 		return loadedTexture;
 	}
 
+	Texture* Texture::LoadFromCache(const std::string& cachePath, const std::string& sourcePath, TextureFormat format)
+	{
+		using namespace TextureCache;
+
+		std::unique_ptr<MappedFile> pFile{ MappedFile::Open(cachePath) };
+		if (!pFile || pFile->GetSize() < sizeof(Header)) return nullptr;
+
+		Header header{};
+		std::memcpy(&header, pFile->GetData(), sizeof(Header));
+		if (header.magic != Magic || header.version != Version || header.format != static_cast<uint32_t>(format)) return nullptr;
+		if (header.numLevels == 0 || header.width <= 0 || header.height <= 0) return nullptr;
+		if ((pFile->GetSize() - sizeof(Header)) / sizeof(LevelDesc) < header.numLevels) return nullptr;
+
+		//A changed timestamp alone is not enough to throw the cache away, checkouts and copies touch it too
+		if (header.sourceSize != FileUtils::GetFileSize(sourcePath)) return nullptr;
+		const int64_t sourceTimestamp{ FileUtils::GetTimestamp(sourcePath) };
+		if (header.sourceTimestamp != sourceTimestamp)
+		{
+			if (header.sourceHash != FileUtils::HashFile(sourcePath)) return nullptr;
+
+			//Same contents, store the new timestamp so the next start does not hash the source again
+			pFile.reset();
+			{
+				std::fstream file{ cachePath, std::ios::binary | std::ios::in | std::ios::out };
+				if (file)
+				{
+					file.seekp(offsetof(Header, sourceTimestamp));
+					file.write(reinterpret_cast<const char*>(&sourceTimestamp), sizeof(sourceTimestamp));
+				}
+			}
+			pFile = MappedFile::Open(cachePath);
+			if (!pFile || pFile->GetSize() < sizeof(Header) + header.numLevels * sizeof(LevelDesc)) return nullptr;
+		}
+
+		Texture* pTexture{ new Texture() };
+		pTexture->m_Format = format;
+		pTexture->m_Width = header.width;
+		pTexture->m_Height = header.height;
+		pTexture->m_Levels.reserve(header.numLevels);
+		for (uint32_t levelIdx{}; levelIdx < header.numLevels; ++levelIdx)
+		{
+			LevelDesc levelDesc{};
+			std::memcpy(&levelDesc, pFile->GetData() + sizeof(Header) + levelIdx * sizeof(LevelDesc), sizeof(LevelDesc));
+			const MipLevel level{ nullptr, levelDesc.width, levelDesc.height,
+				(levelDesc.width + BlockCompression::BlockDimension - 1) / BlockCompression::BlockDimension };
+			if (levelDesc.width <= 0 || levelDesc.height <= 0 || levelDesc.size != pTexture->GetLevelSize(level)
+				|| levelDesc.size > pFile->GetSize() || levelDesc.offset > pFile->GetSize() - levelDesc.size)
+			{
+				delete pTexture;
+				return nullptr;
+			}
+
+			//Point straight into the mapping, the texels are never copied
+			pTexture->m_Levels.push_back(MipLevel{ pFile->GetData() + levelDesc.offset, level.width, level.height, level.blocksX });
+		}
+		pTexture->m_pMappedFile = std::move(pFile);
+		return pTexture;
+	}
+
+	bool Texture::WriteToCache(const std::string& cachePath, const std::string& sourcePath) const
+	{
+		using namespace TextureCache;
+
+		Header header{};
+		header.format = static_cast<uint32_t>(m_Format);
+		header.numLevels = static_cast<uint32_t>(m_Levels.size());
+		header.width = m_Width;
+		header.height = m_Height;
+		header.sourceSize = FileUtils::GetFileSize(sourcePath);
+		header.sourceTimestamp = FileUtils::GetTimestamp(sourcePath);
+		header.sourceHash = FileUtils::HashFile(sourcePath);
+
+		std::vector<LevelDesc> levelDescs{};
+		levelDescs.reserve(m_Levels.size());
+		uint64_t offset{ sizeof(Header) + m_Levels.size() * sizeof(LevelDesc) };
+		for (size_t levelIdx{}; levelIdx < m_Levels.size(); ++levelIdx)
+		{
+			offset = (offset + DataAlignment - 1) & ~(DataAlignment - 1);
+			const uint64_t levelSize{ GetLevelSize(m_Levels[levelIdx]) };
+			levelDescs.push_back(LevelDesc{ offset, levelSize, m_Levels[levelIdx].width, m_Levels[levelIdx].height });
+			offset += levelSize;
+		}
+
+		//Write to a temporary file first so a crash or a second instance never maps a half written cache
+		const std::string tempPath{ cachePath + ".tmp" };
+		{
+			std::ofstream file{ tempPath, std::ios::binary };
+			if (!file) return false;
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+			file.write(reinterpret_cast<const char*>(levelDescs.data()), levelDescs.size() * sizeof(LevelDesc));
+			uint64_t writtenBytes{ sizeof(Header) + levelDescs.size() * sizeof(LevelDesc) };
+			for (size_t levelIdx{}; levelIdx < m_Levels.size(); ++levelIdx)
+			{
+				const char padding[DataAlignment]{};
+				file.write(padding, levelDescs[levelIdx].offset - writtenBytes);
+				file.write(reinterpret_cast<const char*>(m_Levels[levelIdx].pData), levelDescs[levelIdx].size);
+				writtenBytes = levelDescs[levelIdx].offset + levelDescs[levelIdx].size;
+			}
+			if (!file) return false;
+		}
+
+		std::error_code error{};
+		std::filesystem::rename(tempPath, cachePath, error);
+		return !error;
+	}
+
+	void Texture::BuildLevels(std::vector<uint8_t>&& rgbaTexels)
+	{
+		using namespace BlockCompression;
+
+		//Full mip chain down to 1x1, each level is a box filtered copy of the previous one
+		std::vector<std::vector<uint8_t>> rgbaLevels{};
+		std::vector<Int2> levelSizes{ Int2{ m_Width, m_Height } };
+		rgbaLevels.push_back(std::move(rgbaTexels));
+		while (levelSizes.back().x > 1 || levelSizes.back().y > 1)
+		{
+			const Int2 srcSize{ levelSizes.back() };
+			const Int2 dstSize{ std::max(srcSize.x / 2, 1), std::max(srcSize.y / 2, 1) };
+			const std::vector<uint8_t>& src{ rgbaLevels.back() };
+			std::vector<uint8_t> dst(static_cast<size_t>(dstSize.x) * dstSize.y * 4);
+			for (int y{}; y < dstSize.y; ++y)
+			{
+				for (int x{}; x < dstSize.x; ++x)
+				{
+					const int x0{ std::min(x * 2, srcSize.x - 1) }, x1{ std::min(x * 2 + 1, srcSize.x - 1) };
+					const int y0{ std::min(y * 2, srcSize.y - 1) }, y1{ std::min(y * 2 + 1, srcSize.y - 1) };
+					for (int channel{}; channel < 4; ++channel)
+					{
+						const int sum{ src[(x0 + y0 * srcSize.x) * 4 + channel] + src[(x1 + y0 * srcSize.x) * 4 + channel]
+							+ src[(x0 + y1 * srcSize.x) * 4 + channel] + src[(x1 + y1 * srcSize.x) * 4 + channel] };
+						dst[(x + y * dstSize.x) * 4 + channel] = static_cast<uint8_t>((sum + 2) / 4);
+					}
+				}
+			}
+			rgbaLevels.push_back(std::move(dst));
+			levelSizes.push_back(dstSize);
+		}
+
+		m_Levels.clear();
+		m_Levels.reserve(rgbaLevels.size());
+		size_t storageSize{};
+		for (const Int2& levelSize : levelSizes)
+		{
+			MipLevel level{ nullptr, levelSize.x, levelSize.y, (levelSize.x + BlockDimension - 1) / BlockDimension };
+			storageSize += GetLevelSize(level);
+			m_Levels.push_back(level);
+		}
+
+		m_Storage.resize(storageSize);
+		size_t offset{};
+		for (size_t levelIdx{}; levelIdx < m_Levels.size(); ++levelIdx)
+		{
+			MipLevel& level{ m_Levels[levelIdx] };
+			level.pData = m_Storage.data() + offset;
+			switch (m_Format)
+			{
+			case TextureFormat::RGBA8:
+				std::memcpy(m_Storage.data() + offset, rgbaLevels[levelIdx].data(), rgbaLevels[levelIdx].size());
+				break;
+			case TextureFormat::NormalSNORM8:
+				PackNormalLevel(rgbaLevels[levelIdx].data(), level, m_Storage.data() + offset);
+				break;
+			default:
+				CompressLevel(rgbaLevels[levelIdx].data(), level, m_Storage.data() + offset);
+				break;
+			}
+			offset += GetLevelSize(level);
+		}
+	}
+
+	void Texture::CompressLevel(const uint8_t* pRgbaTexels, const MipLevel& level, uint8_t* pBlocks) const
+	{
+		using namespace BlockCompression;
+
+		const size_t blockSize{ GetBlockSize(m_Format) };
+		const int blocksY{ (level.height + BlockDimension - 1) / BlockDimension };
+		for (int blockY{}; blockY < blocksY; ++blockY)
+		{
+			for (int blockX{}; blockX < level.blocksX; ++blockX)
+			{
+				//Edge blocks of textures that are not a multiple of 4 repeat the last row/column
+				uint8_t texels[TexelsPerBlock][3]{};
+				for (int texelIdx{}; texelIdx < TexelsPerBlock; ++texelIdx)
+				{
+					const int x{ std::min(blockX * BlockDimension + texelIdx % BlockDimension, level.width - 1) };
+					const int y{ std::min(blockY * BlockDimension + texelIdx / BlockDimension, level.height - 1) };
+					std::memcpy(texels[texelIdx], pRgbaTexels + (x + y * level.width) * 4, 3);
+				}
+
+				uint8_t* pBlock{ pBlocks + (blockX + blockY * level.blocksX) * blockSize };
+				switch (m_Format)
+				{
+				case TextureFormat::BC1:
+					EncodeBC1(texels, pBlock);
+					break;
+				case TextureFormat::BC4:
+				case TextureFormat::BC5:
+				{
+					uint8_t red[TexelsPerBlock]{}, green[TexelsPerBlock]{};
+					for (int texelIdx{}; texelIdx < TexelsPerBlock; ++texelIdx)
+					{
+						red[texelIdx] = texels[texelIdx][0];
+						green[texelIdx] = texels[texelIdx][1];
+					}
+					EncodeBC4(red, pBlock);
+					if (m_Format == TextureFormat::BC5) EncodeBC4(green, pBlock + 8);
+				}
+				break;
+				default:
+					break;
+				}
+			}
+		}
+	}
+
+	void Texture::PackNormalLevel(const uint8_t* pRgbaTexels, const MipLevel& level, uint8_t* pTexels) const
+	{
+		//Unpack and normalize once here instead of for every shaded pixel, this also renormalizes the filtered mips
+		const int numTexels{ level.width * level.height };
+		for (int texelIdx{}; texelIdx < numTexels; ++texelIdx)
+		{
+			const uint8_t* pRgba{ pRgbaTexels + texelIdx * 4 };
+			Vector3 normal{ pRgba[0] * (2.f / 255.f) - 1.f, pRgba[1] * (2.f / 255.f) - 1.f, pRgba[2] * (2.f / 255.f) - 1.f };
+			if (normal.SqrMagnitude() > 0.f) normal.Normalize();
+			else normal = Vector3::UnitZ;
+
+			int8_t* pSigned{ reinterpret_cast<int8_t*>(pTexels + texelIdx * 4) };
+			pSigned[0] = static_cast<int8_t>(std::lround(normal.x * 127.f));
+			pSigned[1] = static_cast<int8_t>(std::lround(normal.y * 127.f));
+			pSigned[2] = static_cast<int8_t>(std::lround(normal.z * 127.f));
+			pSigned[3] = 0;
+		}
+	}
+
+	size_t Texture::GetLevelSize(const MipLevel& level) const
+	{
+		using namespace BlockCompression;
+
+		if (m_Format == TextureFormat::RGBA8 || m_Format == TextureFormat::NormalSNORM8) return static_cast<size_t>(level.width) * level.height * 4;
+		const int blocksY{ (level.height + BlockDimension - 1) / BlockDimension };
+		return GetBlockSize(m_Format) * level.blocksX * blocksY;
+	}
+
+	size_t Texture::GetMemorySize() const
+	{
+		//Mapped textures live in the OS page cache and can be shared between processes
+		if (m_pMappedFile) return 0;
+		return m_Storage.size();
+	}
+
 	ColorRGB Texture::DoSomthing(const Vector2& uv) const
 	{
 		Vector3 test{ 0.f, 0.f, 0.f };
 		return ColorRGB{};
 	}
 
-	ColorRGB Texture::Sample(const Vector2& uv) const
+	ColorRGB Texture::Sample(const Vector2& uv, float lod) const
 	{
-		uint32_t u{ static_cast<uint32_t>(uv.x * m_pSurface->w) };
-		uint32_t v{ static_cast<uint32_t>(uv.y * m_pSurface->h) };
-		//TODO
-		//Sample the correct texel for the given uv
-
 		uint8_t r{}, g{}, b{};
-		uint32_t pixel{ m_pSurfacePixels[u + v * m_pSurface->w] };
-		SDL_GetRGB(pixel, m_pSurface->format, &r, &g, &b);
-		//SDL_GetRGB()
+		FetchTexel(uv, GetLevelIdx(lod), r, g, b);
 
 		return ColorRGB{
-			static_cast<float>(r) * m_ColorModifier, 
+			static_cast<float>(r) * m_ColorModifier,
 			static_cast<float>(g)* m_ColorModifier,
 			static_cast<float>(b) * m_ColorModifier
 		};
 	}
-	
 
-	Vector3 Texture::SampleNormal(const Vector2& uv) const
+
+	Vector3 Texture::SampleNormal(const Vector2& uv, float lod) const
 	{
-		uint32_t u{ static_cast<uint32_t>(uv.x * m_pSurface->w) };
-		uint32_t v{ static_cast<uint32_t>(uv.y * m_pSurface->h) };
-		//TODO
-		//Sample the correct texel for the given uv
+		const int levelIdx{ GetLevelIdx(lod) };
+		if (m_Format == TextureFormat::BC5)
+		{
+			//Decoded texels are already signed and unit length, see ReconstructNormal
+			const MipLevel& level{ m_Levels[levelIdx] };
+			const int x{ std::min(static_cast<int>(uv.x * level.width), level.width - 1) };
+			const int y{ std::min(static_cast<int>(uv.y * level.height), level.height - 1) };
+			uint8_t r{}, g{}, b{};
+			FetchCompressedTexel(level, static_cast<uint32_t>(levelIdx), x, y, r, g, b);
+
+			return Vector3{
+				static_cast<float>(static_cast<int8_t>(r)) * m_SignedModifier,
+				static_cast<float>(static_cast<int8_t>(g)) * m_SignedModifier,
+				static_cast<float>(static_cast<int8_t>(b)) * m_SignedModifier
+			};
+		}
+		if (m_Format == TextureFormat::NormalSNORM8)
+		{
+			const MipLevel& level{ m_Levels[levelIdx] };
+			const int x{ std::min(static_cast<int>(uv.x * level.width), level.width - 1) };
+			const int y{ std::min(static_cast<int>(uv.y * level.height), level.height - 1) };
+			const int8_t* pTexel{ reinterpret_cast<const int8_t*>(level.pData + (x + y * level.width) * 4) };
+
+			return Vector3{
+				static_cast<float>(pTexel[0]) * m_SignedModifier,
+				static_cast<float>(pTexel[1]) * m_SignedModifier,
+				static_cast<float>(pTexel[2]) * m_SignedModifier
+			};
+		}
 
 		uint8_t r{}, g{}, b{};
-		uint32_t pixel{ m_pSurfacePixels[u + v * m_pSurface->w] };
-		SDL_GetRGB(pixel, m_pSurface->format, &r, &g, &b);
-		//SDL_GetRGB()
+		FetchTexel(uv, levelIdx, r, g, b);
 
 		return Vector3{
-			static_cast<float>(r) * m_ColorModifier,
-			static_cast<float>(g) * m_ColorModifier,
-			static_cast<float>(b) * m_ColorModifier
+			static_cast<float>(r) * (2.f * m_ColorModifier) - 1.f,
+			static_cast<float>(g) * (2.f * m_ColorModifier) - 1.f,
+			static_cast<float>(b) * (2.f * m_ColorModifier) - 1.f
 		};
 	}
 
+	int Texture::GetLevelIdx(float lod) const
+	{
+		//Negative and NaN lods both end up on the full resolution level
+		if (!(lod > 0.f)) return 0;
+		return std::min(static_cast<int>(lod), static_cast<int>(m_Levels.size()) - 1);
+	}
+
+	void Texture::FetchTexel(const Vector2& uv, int levelIdx, uint8_t& r, uint8_t& g, uint8_t& b) const
+	{
+		const MipLevel& level{ m_Levels[levelIdx] };
+		const int x{ std::min(static_cast<int>(uv.x * level.width), level.width - 1) };
+		const int y{ std::min(static_cast<int>(uv.y * level.height), level.height - 1) };
+
+		if (m_Format == TextureFormat::RGBA8)
+		{
+			const uint8_t* pTexel{ level.pData + (x + y * level.width) * 4 };
+			r = pTexel[0];
+			g = pTexel[1];
+			b = pTexel[2];
+			return;
+		}
+
+		if (m_Format == TextureFormat::NormalSNORM8)
+		{
+			//Back to the unsigned [0, 255] range so signed normals can still be visualized as colors
+			const int8_t* pTexel{ reinterpret_cast<const int8_t*>(level.pData + (x + y * level.width) * 4) };
+			r = static_cast<uint8_t>(pTexel[0] + 128);
+			g = static_cast<uint8_t>(pTexel[1] + 128);
+			b = static_cast<uint8_t>(pTexel[2] + 128);
+			return;
+		}
+
+		FetchCompressedTexel(level, static_cast<uint32_t>(levelIdx), x, y, r, g, b);
+		if (m_Format == TextureFormat::BC5)
+		{
+			//Signed like NormalSNORM8, see ReconstructNormal
+			r = static_cast<uint8_t>(static_cast<int8_t>(r) + 128);
+			g = static_cast<uint8_t>(static_cast<int8_t>(g) + 128);
+			b = static_cast<uint8_t>(static_cast<int8_t>(b) + 128);
+		}
+	}
+
+	void Texture::FetchCompressedTexel(const MipLevel& level, uint32_t levelIdx, int x, int y, uint8_t& r, uint8_t& g, uint8_t& b) const
+	{
+		using namespace BlockCompression;
+
+		const uint32_t blockIdx{ static_cast<uint32_t>(x / BlockDimension + (y / BlockDimension) * level.blocksX) };
+		const int texelIdx{ x % BlockDimension + (y % BlockDimension) * BlockDimension };
+		const uint8_t* pBlock{ level.pData + blockIdx * GetBlockSize(m_Format) };
+
+#ifdef BC_BLOCK_CACHE
+		DecodedBlock& cachedBlock{ g_BlockCache[(blockIdx + m_Id * 31 + levelIdx * 7) % BlockCacheSize] };
+		if (cachedBlock.textureId != m_Id || cachedBlock.levelIdx != levelIdx || cachedBlock.blockIdx != blockIdx)
+		{
+			cachedBlock.textureId = m_Id;
+			cachedBlock.levelIdx = levelIdx;
+			cachedBlock.blockIdx = blockIdx;
+			for (int decodeIdx{}; decodeIdx < TexelsPerBlock; ++decodeIdx)
+			{
+				DecodeTexel(m_Format, pBlock, decodeIdx, cachedBlock.texels[decodeIdx][0], cachedBlock.texels[decodeIdx][1], cachedBlock.texels[decodeIdx][2]);
+			}
+		}
+		r = cachedBlock.texels[texelIdx][0];
+		g = cachedBlock.texels[texelIdx][1];
+		b = cachedBlock.texels[texelIdx][2];
+#else
+		DecodeTexel(m_Format, pBlock, texelIdx, r, g, b);
+#endif
+	}
+
 	//Vector3 Texture::SampleNormal(const Vector2& uv) const
 	//{
 	//	ColorRGB sampledPixel{ Sample(uv) };
@@ -83,4 +741,4 @@ namespace dae
 	//	sampledNormal = 2.f * sampledNormal - Vector3{ 1.f, 1.f, 1.f };
 	//	return sampledNormal;
 	//}
-}
\ No newline at end of file
+}
@@ -1,28 +1,77 @@
 #pragma once
 #include "Vector3.h"
-#include <SDL_surface.h>
+#include <memory>
 #include <string>
+#include <vector>
 #include "ColorRGB.h"
 
 namespace dae
 {
 	struct Vector2;
-	
+	class MappedFile;
+
+	enum class TextureFormat
+	{
+		RGBA8, //Uncompressed, 32 bits per texel
+		BC1, //RGB 5:6:5 endpoints, 4 bits per texel
+		BC4, //Single channel, 4 bits per texel
+		BC5, //Two channels (normal xy, z reconstructed), 8 bits per texel
+		NormalSNORM8 //Signed, pre-normalized tangent space normal, 32 bits per texel
+	};
+
 	class Texture final
 	{
 	public:
 		~Texture();
 
-		static Texture* LoadFromFile(const std::string& path);
-		ColorRGB Sample(const Vector2& uv) const;
+		static Texture* LoadFromFile(const std::string& path, TextureFormat format = TextureFormat::RGBA8);
+		//The lod picks the nearest finer mip level, 0 is the full resolution
+		ColorRGB Sample(const Vector2& uv, float lod = 0.f) const;
 		ColorRGB DoSomthing(const Vector2& uv) const;
-		Vector3 SampleNormal(const Vector2& uv) const;
+		//Returns the signed tangent space normal, already unpacked from the [0, 1] texel range
+		Vector3 SampleNormal(const Vector2& uv, float lod = 0.f) const;
+
+		TextureFormat GetFormat() const { return m_Format; }
+		int GetWidth() const { return m_Width; }
+		int GetHeight() const { return m_Height; }
+		size_t GetMemorySize() const;
 
 	private:
-		Texture(SDL_Surface* pSurface);
+		struct MipLevel
+		{
+			const uint8_t* pData{ nullptr };
+			int width{};
+			int height{};
+			int blocksX{};
+		};
+
+		Texture();
 
-		SDL_Surface* m_pSurface{ nullptr };
-		uint32_t* m_pSurfacePixels{ nullptr };
 		const float m_ColorModifier{ 1.f / 255.f };
+		const float m_SignedModifier{ 1.f / 127.f };
+
+		TextureFormat m_Format{ TextureFormat::RGBA8 };
+		int m_Width{};
+		int m_Height{};
+		std::vector<MipLevel> m_Levels{};
+
+		//Texels either live in m_Storage or in the mapped texture cache, never in both
+		std::vector<uint8_t> m_Storage{};
+		std::unique_ptr<MappedFile> m_pMappedFile{};
+
+		//Unique per texture so the decoded block cache never confuses two textures at the same address
+		uint32_t m_Id{};
+
+		static Texture* LoadFromCache(const std::string& cachePath, const std::string& sourcePath, TextureFormat format);
+		bool WriteToCache(const std::string& cachePath, const std::string& sourcePath) const;
+
+		void BuildLevels(std::vector<uint8_t>&& rgbaTexels);
+		void CompressLevel(const uint8_t* pRgbaTexels, const MipLevel& level, uint8_t* pBlocks) const;
+		void PackNormalLevel(const uint8_t* pRgbaTexels, const MipLevel& level, uint8_t* pTexels) const;
+		size_t GetLevelSize(const MipLevel& level) const;
+
+		int GetLevelIdx(float lod) const;
+		void FetchTexel(const Vector2& uv, int levelIdx, uint8_t& r, uint8_t& g, uint8_t& b) const;
+		void FetchCompressedTexel(const MipLevel& level, uint32_t levelIdx, int x, int y, uint8_t& r, uint8_t& g, uint8_t& b) const;
 	};
-}
\ No newline at end of file
+}
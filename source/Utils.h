@@ -1,170 +1,326 @@
 #pragma once
+#include <atomic>
 #include <cassert>
-#include <fstream>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <ppl.h>
+#include "FloatPacket.h"
 #include "Math.h"
 #include "DataTypes.h"
+#include "MappedFile.h"
 //#define DISABLE_OBJ
 
 namespace dae
 {
-	namespace Utils
+	namespace FileUtils
 	{
-		//Just parses vertices and indices
-#pragma warning(push)
-#pragma warning(disable : 4505) //Warning unreferenced local function
-		static bool ParseOBJ(const std::string& filename, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool flipAxisAndWinding = true)
+		//FNV-1a, only needed when the timestamp of a cached source changed
+		inline uint64_t HashFile(const std::string& path)
 		{
-#ifdef DISABLE_OBJ
+			const std::unique_ptr<MappedFile> pFile{ MappedFile::Open(path) };
+			if (!pFile) return 0;
 
-			//TODO: Enable the code below after uncommenting all the vertex attributes of DataTypes::Vertex
-			// >> Comment/Remove '#define DISABLE_OBJ'
-			assert(false && "OBJ PARSER not enabled! Check the comments in Utils::ParseOBJ");
+			uint64_t hash{ 14695981039346656037ull };
+			for (size_t byteIdx{}; byteIdx < pFile->GetSize(); ++byteIdx)
+			{
+				hash = (hash ^ pFile->GetData()[byteIdx]) * 1099511628211ull;
+			}
+			return hash;
+		}
 
-#else
-			std::ifstream file(filename);
-			if (!file)
-				return false;
+		inline int64_t GetTimestamp(const std::string& path)
+		{
+			std::error_code error{};
+			const auto timestamp{ std::filesystem::last_write_time(path, error) };
+			return error ? 0 : static_cast<int64_t>(timestamp.time_since_epoch().count());
+		}
+
+		inline uint64_t GetFileSize(const std::string& path)
+		{
+			std::error_code error{};
+			const uintmax_t fileSize{ std::filesystem::file_size(path, error) };
+			return error ? 0 : static_cast<uint64_t>(fileSize);
+		}
+	}
+
+	namespace ObjScanner
+	{
+		inline bool IsSpace(char c)
+		{
+			return c == ' ' || c == '\t';
+		}
+
+		inline const char* SkipSpaces(const char* pCursor, const char* pEnd)
+		{
+			while (pCursor < pEnd && IsSpace(*pCursor)) ++pCursor;
+			return pCursor;
+		}
 
-			std::vector<Vector3> positions{};
-			std::vector<Vector3> normals{};
-			std::vector<Vector2> UVs{};
+		inline const char* SkipLine(const char* pCursor, const char* pEnd)
+		{
+			const void* pNewLine{ std::memchr(pCursor, '\n', pEnd - pCursor) };
+			return pNewLine ? static_cast<const char*>(pNewLine) + 1 : pEnd;
+		}
+
+		//Locale independent, a malformed number leaves value untouched and the cursor where it was
+		inline const char* ParseFloat(const char* pCursor, const char* pEnd, float& value)
+		{
+			pCursor = SkipSpaces(pCursor, pEnd);
+			const auto [pNext, error] { std::from_chars(pCursor, pEnd, value) };
+			return error == std::errc{} ? pNext : pCursor;
+		}
 
-			vertices.clear();
-			indices.clear();
+		inline const char* ParseIndex(const char* pCursor, const char* pEnd, uint32_t& value)
+		{
+			pCursor = SkipSpaces(pCursor, pEnd);
+			const auto [pNext, error] { std::from_chars(pCursor, pEnd, value) };
+			return error == std::errc{} ? pNext : pCursor;
+		}
+
+		//A line aligned slice of the file, the first* members are the prefix summed offsets into the shared arrays
+		struct Chunk
+		{
+			const char* pBegin{};
+			const char* pEnd{};
+			size_t numPositions{}, numNormals{}, numUVs{}, numFaces{};
+			size_t firstPosition{}, firstNormal{}, firstUV{}, firstFace{};
+		};
 
-			std::string sCommand;
-			// start a while iteration ending when the end of file is reached (ios::eof)
-			while (!file.eof())
+		inline std::vector<Chunk> SplitIntoChunks(const char* pBegin, const char* pEnd, size_t numChunks)
+		{
+			std::vector<Chunk> chunks{};
+			const size_t chunkSize{ std::max<size_t>(static_cast<size_t>(pEnd - pBegin) / numChunks, 1) };
+			for (const char* pChunk{ pBegin }; pChunk < pEnd;)
 			{
-				//read the first word of the string, use the >> operator (istream::operator>>) 
-				file >> sCommand;
-				//use conditional statements to process the different commands	
-				if (sCommand == "#")
+				//Move the split forward to the next line start so no record is cut in half
+				const char* pSplit{ static_cast<size_t>(pEnd - pChunk) > chunkSize ? SkipLine(pChunk + chunkSize - 1, pEnd) : pEnd };
+				chunks.push_back(Chunk{ pChunk, pSplit });
+				pChunk = pSplit;
+			}
+			return chunks;
+		}
+
+		inline void CountRecords(Chunk& chunk)
+		{
+			for (const char* pLine{ chunk.pBegin }; pLine < chunk.pEnd; pLine = SkipLine(pLine, chunk.pEnd))
+			{
+				pLine = SkipSpaces(pLine, chunk.pEnd);
+				if (chunk.pEnd - pLine < 2) break;
+				if (pLine[0] == 'v')
 				{
-					// Ignore Comment
+					if (IsSpace(pLine[1])) ++chunk.numPositions;
+					else if (pLine[1] == 't') ++chunk.numUVs;
+					else if (pLine[1] == 'n') ++chunk.numNormals;
 				}
-				else if (sCommand == "v")
+				else if (pLine[0] == 'f' && IsSpace(pLine[1])) ++chunk.numFaces;
+			}
+		}
+
+		inline void ParseAttributes(const Chunk& chunk, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<Vector2>& UVs)
+		{
+			size_t positionIdx{ chunk.firstPosition }, normalIdx{ chunk.firstNormal }, uvIdx{ chunk.firstUV };
+			for (const char* pLine{ chunk.pBegin }; pLine < chunk.pEnd; pLine = SkipLine(pLine, chunk.pEnd))
+			{
+				pLine = SkipSpaces(pLine, chunk.pEnd);
+				if (chunk.pEnd - pLine < 2 || pLine[0] != 'v') continue;
+
+				if (IsSpace(pLine[1]))
 				{
 					//Vertex
-					float x, y, z;
-					file >> x >> y >> z;
-
-					positions.emplace_back(x, y, z);
+					Vector3& position{ positions[positionIdx++] };
+					const char* pCursor{ ParseFloat(pLine + 1, chunk.pEnd, position.x) };
+					pCursor = ParseFloat(pCursor, chunk.pEnd, position.y);
+					ParseFloat(pCursor, chunk.pEnd, position.z);
 				}
-				else if (sCommand == "vt")
+				else if (pLine[1] == 't')
 				{
 					// Vertex TexCoord
-					float u, v;
-					file >> u >> v;
-					UVs.emplace_back(u, 1 - v);
+					float u{}, v{};
+					const char* pCursor{ ParseFloat(pLine + 2, chunk.pEnd, u) };
+					ParseFloat(pCursor, chunk.pEnd, v);
+					UVs[uvIdx++] = Vector2{ u, 1 - v };
 				}
-				else if (sCommand == "vn")
+				else if (pLine[1] == 'n')
 				{
 					// Vertex Normal
-					float x, y, z;
-					file >> x >> y >> z;
-
-					normals.emplace_back(x, y, z);
+					Vector3& normal{ normals[normalIdx++] };
+					const char* pCursor{ ParseFloat(pLine + 2, chunk.pEnd, normal.x) };
+					pCursor = ParseFloat(pCursor, chunk.pEnd, normal.y);
+					ParseFloat(pCursor, chunk.pEnd, normal.z);
 				}
-				else if (sCommand == "f")
+			}
+		}
+
+		//Face indices are global, so this may only run once the attributes of every chunk are parsed
+		inline bool ParseFaces(const Chunk& chunk, const std::vector<Vector3>& positions, const std::vector<Vector3>& normals, const std::vector<Vector2>& UVs,
+			std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool flipAxisAndWinding)
+		{
+			size_t faceIdx{ chunk.firstFace };
+			for (const char* pLine{ chunk.pBegin }; pLine < chunk.pEnd; pLine = SkipLine(pLine, chunk.pEnd))
+			{
+				pLine = SkipSpaces(pLine, chunk.pEnd);
+				if (chunk.pEnd - pLine < 2 || pLine[0] != 'f' || !IsSpace(pLine[1])) continue;
+
+				// Faces or triangles, every face corner becomes its own vertex
+				const char* pCursor{ pLine + 1 };
+				for (size_t iFace = 0; iFace < 3; iFace++)
 				{
-					//if a face is read:
-					//construct the 3 vertices, add them to the vertex array
-					//add three indices to the index array
-					//add the material index as attibute to the attribute array
-					//
-					// Faces or triangles
-					Vertex vertex{};
-					size_t iPosition, iTexCoord, iNormal;
-
-					uint32_t tempIndices[3];
-					for (size_t iFace = 0; iFace < 3; iFace++)
-					{
-						// OBJ format uses 1-based arrays
-						file >> iPosition;
-						vertex.position = positions[iPosition - 1];
+					Vertex& vertex{ vertices[faceIdx * 3 + iFace] };
+					uint32_t iPosition{}, iTexCoord{}, iNormal{};
 
-						if ('/' == file.peek())//is next in buffer ==  '/' ?
+					// OBJ format uses 1-based arrays
+					pCursor = ParseIndex(pCursor, chunk.pEnd, iPosition);
+					if (iPosition == 0 || iPosition > positions.size())
+						return false;
+					vertex.position = positions[iPosition - 1];
+
+					if (pCursor < chunk.pEnd && *pCursor == '/')
+					{
+						++pCursor;
+						if (pCursor < chunk.pEnd && *pCursor != '/')
 						{
-							file.ignore();//read and ignore one element ('/')
-
-							if ('/' != file.peek())
-							{
-								// Optional texture coordinate
-								file >> iTexCoord;
-								vertex.uv = UVs[iTexCoord - 1];
-							}
-
-							if ('/' == file.peek())
-							{
-								file.ignore();
-
-								// Optional vertex normal
-								file >> iNormal;
-								vertex.normal = normals[iNormal - 1];
-							}
+							// Optional texture coordinate
+							pCursor = ParseIndex(pCursor, chunk.pEnd, iTexCoord);
+							if (iTexCoord == 0 || iTexCoord > UVs.size())
+								return false;
+							vertex.uv = UVs[iTexCoord - 1];
 						}
 
-						vertices.push_back(vertex);
-						tempIndices[iFace] = uint32_t(vertices.size()) - 1;
-						//indices.push_back(uint32_t(vertices.size()) - 1);
-					}
-
-					indices.push_back(tempIndices[0]);
-					if (flipAxisAndWinding) 
-					{
-						indices.push_back(tempIndices[2]);
-						indices.push_back(tempIndices[1]);
-					}
-					else
-					{
-						indices.push_back(tempIndices[1]);
-						indices.push_back(tempIndices[2]);
+						if (pCursor < chunk.pEnd && *pCursor == '/')
+						{
+							// Optional vertex normal
+							pCursor = ParseIndex(pCursor + 1, chunk.pEnd, iNormal);
+							if (iNormal == 0 || iNormal > normals.size())
+								return false;
+							vertex.normal = normals[iNormal - 1];
+						}
 					}
 				}
-				//read till end of line and ignore all remaining chars
-				file.ignore(1000, '\n');
+
+				const uint32_t firstVertex{ static_cast<uint32_t>(faceIdx * 3) };
+				indices[faceIdx * 3] = firstVertex;
+				indices[faceIdx * 3 + 1] = flipAxisAndWinding ? firstVertex + 2 : firstVertex + 1;
+				indices[faceIdx * 3 + 2] = flipAxisAndWinding ? firstVertex + 1 : firstVertex + 2;
+				++faceIdx;
 			}
+			return true;
+		}
+	}
 
-			//Cheap Tangent Calculations
-			for (uint32_t i = 0; i < indices.size(); i += 3)
+	namespace Utils
+	{
+		//Just parses vertices and indices
+#pragma warning(push)
+#pragma warning(disable : 4505) //Warning unreferenced local function
+		static bool ParseOBJ(const std::string& filename, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool flipAxisAndWinding = true)
+		{
+#ifdef DISABLE_OBJ
+
+			//TODO: Enable the code below after uncommenting all the vertex attributes of DataTypes::Vertex
+			// >> Comment/Remove '#define DISABLE_OBJ'
+			assert(false && "OBJ PARSER not enabled! Check the comments in Utils::ParseOBJ");
+
+#else
+			//Map the whole file, the scanner below walks the bytes directly without any stream or locale overhead
+			const std::unique_ptr<MappedFile> pFile{ MappedFile::Open(filename) };
+			if (!pFile)
+				return false;
+
+			const char* const pBegin{ reinterpret_cast<const char*>(pFile->GetData()) };
+			const char* const pEnd{ pBegin + pFile->GetSize() };
+
+			//Small files stay in a single chunk, big ones get a few chunks per core for load balancing
+			constexpr size_t minChunkSize{ 256 * 1024 };
+			const size_t numChunks{ std::clamp<size_t>(pFile->GetSize() / minChunkSize, 1, std::max(std::thread::hardware_concurrency(), 1u) * 4) };
+			std::vector<ObjScanner::Chunk> chunks{ ObjScanner::SplitIntoChunks(pBegin, pEnd, numChunks) };
+
+			//First pass only counts the records, the prefix sums give every chunk its own range in the shared arrays
+			concurrency::parallel_for(size_t{}, chunks.size(), [&chunks](size_t chunkIdx) { ObjScanner::CountRecords(chunks[chunkIdx]); });
+
+			size_t numPositions{}, numNormals{}, numUVs{}, numFaces{};
+			for (ObjScanner::Chunk& chunk : chunks)
 			{
-				uint32_t index0 = indices[i];
-				uint32_t index1 = indices[size_t(i) + 1];
-				uint32_t index2 = indices[size_t(i) + 2];
-
-				const Vector3& p0 = vertices[index0].position;
-				const Vector3& p1 = vertices[index1].position;
-				const Vector3& p2 = vertices[index2].position;
-				const Vector2& uv0 = vertices[index0].uv;
-				const Vector2& uv1 = vertices[index1].uv;
-				const Vector2& uv2 = vertices[index2].uv;
-
-				const Vector3 edge0 = p1 - p0;
-				const Vector3 edge1 = p2 - p0;
-				const Vector2 diffX = Vector2(uv1.x - uv0.x, uv2.x - uv0.x);
-				const Vector2 diffY = Vector2(uv1.y - uv0.y, uv2.y - uv0.y);
-				float r = 1.f / Vector2::Cross(diffX, diffY);
-
-				Vector3 tangent = (edge0 * diffY.y - edge1 * diffY.x) * r;
-				vertices[index0].tangent += tangent;
-				vertices[index1].tangent += tangent;
-				vertices[index2].tangent += tangent;
+				chunk.firstPosition = numPositions;
+				chunk.firstNormal = numNormals;
+				chunk.firstUV = numUVs;
+				chunk.firstFace = numFaces;
+				numPositions += chunk.numPositions;
+				numNormals += chunk.numNormals;
+				numUVs += chunk.numUVs;
+				numFaces += chunk.numFaces;
 			}
 
-			//Fix the tangents per vertex now because we accumulated
-			for (auto& v : vertices)
-			{
-				v.tangent = Vector3::Reject(v.tangent, v.normal).Normalized();
+			std::vector<Vector3> positions(numPositions);
+			std::vector<Vector3> normals(numNormals);
+			std::vector<Vector2> UVs(numUVs);
 
-				if(flipAxisAndWinding)
+			vertices.assign(numFaces * 3, Vertex{});
+			indices.assign(numFaces * 3, 0);
+
+			concurrency::parallel_for(size_t{}, chunks.size(), [&](size_t chunkIdx)
 				{
-					v.position.z *= -1.f;
-					v.normal.z *= -1.f;
-					v.tangent.z *= -1.f;
+					ObjScanner::ParseAttributes(chunks[chunkIdx], positions, normals, UVs);
 				}
+			);
 
-			}
+			std::atomic<bool> areFacesValid{ true };
+			concurrency::parallel_for(size_t{}, chunks.size(), [&](size_t chunkIdx)
+				{
+					if (!ObjScanner::ParseFaces(chunks[chunkIdx], positions, normals, UVs, vertices, indices, flipAxisAndWinding))
+						areFacesValid = false;
+				}
+			);
+			if (!areFacesValid)
+				return false;
+
+			//Cheap Tangent Calculations
+			//Every face corner is a separate vertex, so the triangles never share an accumulator and can run in parallel
+			const uint32_t numTriangles{ static_cast<uint32_t>(indices.size() / 3) };
+			concurrency::parallel_for(0u, numTriangles, [&](uint32_t triangleIdx)
+				{
+					const size_t i{ size_t(triangleIdx) * 3 };
+					uint32_t index0 = indices[i];
+					uint32_t index1 = indices[i + 1];
+					uint32_t index2 = indices[i + 2];
+
+					const Vector3& p0 = vertices[index0].position;
+					const Vector3& p1 = vertices[index1].position;
+					const Vector3& p2 = vertices[index2].position;
+					const Vector2& uv0 = vertices[index0].uv;
+					const Vector2& uv1 = vertices[index1].uv;
+					const Vector2& uv2 = vertices[index2].uv;
+
+					const Vector3 edge0 = p1 - p0;
+					const Vector3 edge1 = p2 - p0;
+					const Vector2 diffX = Vector2(uv1.x - uv0.x, uv2.x - uv0.x);
+					const Vector2 diffY = Vector2(uv1.y - uv0.y, uv2.y - uv0.y);
+					float r = 1.f / Vector2::Cross(diffX, diffY);
+
+					Vector3 tangent = (edge0 * diffY.y - edge1 * diffY.x) * r;
+					vertices[index0].tangent += tangent;
+					vertices[index1].tangent += tangent;
+					vertices[index2].tangent += tangent;
+				}
+			);
+
+			//Fix the tangents per vertex now because we accumulated
+			concurrency::parallel_for(size_t{}, vertices.size(), [&](size_t vertexIdx)
+				{
+					Vertex& v{ vertices[vertexIdx] };
+					v.tangent = Vector3::Reject(v.tangent, v.normal).Normalized();
+
+					if(flipAxisAndWinding)
+					{
+						v.position.z *= -1.f;
+						v.normal.z *= -1.f;
+						v.tangent.z *= -1.f;
+					}
+				}
+			);
 
 			return true;
 #endif
@@ -210,11 +366,74 @@ namespace dae
 			return IsPointInTriangle(v0, v1, v2, pixel, signedArea0, signedArea1, signedArea2);
 		}
 
+		//Screen space linear function c + dx * x + dy * y, the barycentric weights and every attribute divided by w are of this form
+		//Set up once per triangle, the rasterizer then steps it across a row by adding dx
+		//x and y are relative to an origin near the triangle, which keeps c small and the evaluation precise
+		struct PlaneEquation
+		{
+			float dx{};
+			float dy{};
+			float c{};
+
+			//Signed area of v0, v1 and the point, scaled by scale
+			static PlaneEquation FromEdge(const Vector2& v0, const Vector2& v1, const Vector2& origin, float scale)
+			{
+				const Vector2 edge{ v1 - v0 };
+				return PlaneEquation{ -edge.y * scale, edge.x * scale, Vector2::Cross(edge, origin - v0) * scale };
+			}
+
+			//The plane through value0, value1 and value2 at the corners where the matching weight is one
+			static PlaneEquation FromWeights(const PlaneEquation& weight0, const PlaneEquation& weight1, const PlaneEquation& weight2,
+				float value0, float value1, float value2)
+			{
+				return PlaneEquation{
+					weight0.dx * value0 + weight1.dx * value1 + weight2.dx * value2,
+					weight0.dy * value0 + weight1.dy * value1 + weight2.dy * value2,
+					weight0.c * value0 + weight1.c * value1 + weight2.c * value2 };
+			}
+
+			float Evaluate(float x, float y) const
+			{
+				return c + dx * x + dy * y;
+			}
+
+			//A packet of pixels starting at x, one pixel per lane
+			FloatPacket EvaluatePacket(float x, float y) const
+			{
+				return FloatPacket{ Evaluate(x, y) } + FloatPacket::LaneIndices() * dx;
+			}
+
+			//A packet of 2x2 quads with its first quad's top left pixel at x, y
+			FloatPacket EvaluateQuads(float x, float y) const
+			{
+				return FloatPacket{ Evaluate(x, y) } + FloatPacket::QuadLaneX() * dx + FloatPacket::QuadLaneY() * dy;
+			}
+		};
+
 		inline bool IsVertexInFrustrum(const Vector4& vertex, float min = -1.f, float max = 1.f)
 		{
 			return vertex.x >= min && vertex.x <= max && vertex.y >= min && vertex.y <= max && vertex.z >= 0.f && vertex.z <= max;
 		}
 
+		//Sphere against the view frustum, center in view space and the fov given as tan of the half angle like the camera stores it
+		inline bool IsSphereInFrustum(const Vector3& centerView, float radius, float fov, float aspectRatio, float nearPlane, float farPlane)
+		{
+			if (centerView.z + radius < nearPlane || centerView.z - radius > farPlane) return false;
+
+			//Side planes pass through the eye, x = z * tan, so the distance is scaled by the length of their normal
+			const float fovX{ fov * aspectRatio };
+			if (std::abs(centerView.x) - centerView.z * fovX > radius * sqrtf(1.f + fovX * fovX)) return false;
+			if (std::abs(centerView.y) - centerView.z * fov > radius * sqrtf(1.f + fov * fov)) return false;
+			return true;
+		}
+
+		//True when every triangle inside the bounding sphere whose normals lie in the cone faces away from the eye
+		inline bool IsConeBackFacing(const Vector3& center, float radius, const Vector3& coneAxis, float coneCutoff, const Vector3& eye)
+		{
+			const Vector3 toCenter{ center - eye };
+			return Vector3::Dot(toCenter, coneAxis) >= coneCutoff * toCenter.Magnitude() + radius;
+		}
+
 		inline Vector2 GetPointOfIntersection(const Vector2& tri0, const Vector2& tri1, const Vector2& edge0, const Vector2& edge1)
 		{
 			const Vector2 triEdge{ tri0 - tri1};
@@ -253,5 +472,48 @@ namespace dae
 			const float specularReflection{ ks * powf(cosa, exp) };
 			return specularColor * specularReflection;
 		}
+
+		static ColorPacket Lambert(float kd, const ColorPacket& cd)
+		{
+			return cd * FloatPacket{ kd / PI };
+		}
+
+		//Same as Phong above for a whole packet
+		//The fast pow stays within 3e-4 of powf for exponents up to 25, well below one step of an 8-bit channel
+		template<bool UseFastPow = true>
+		static ColorPacket Phong(const ColorPacket& specularColor, float ks, const FloatPacket& exp, const Vector3Packet& l, const Vector3Packet& v, const Vector3Packet& n)
+		{
+			const Vector3Packet reflect{ Vector3Packet::Reflect(l, n) };
+			const FloatPacket cosa{ Max(Vector3Packet::Dot(reflect, v), 0.f) };
+			if constexpr (UseFastPow) return specularColor * (Pow(cosa, exp) * ks);
+			else return specularColor * (PowExact(cosa, exp) * ks);
+		}
+
+		//Specular part of Cook-Torrance for a whole packet, GGX distribution, Schlick's Smith visibility and Schlick's Fresnel
+		//The roughness is the perceptual one, squared into the GGX alpha, and like Phong the cosine of the light is left to the caller
+		static ColorPacket CookTorrance(const ColorPacket& f0, const FloatPacket& roughness, const Vector3Packet& l, const Vector3Packet& v, const Vector3Packet& n)
+		{
+			const Vector3Packet halfVector{ (v - l).Normalized() };
+			const FloatPacket nDotL{ Max(-Vector3Packet::Dot(n, l), 0.f) };
+			const FloatPacket nDotV{ Max(Vector3Packet::Dot(n, v), 1e-4f) };
+			const FloatPacket nDotH{ Max(Vector3Packet::Dot(n, halfVector), 0.f) };
+			const FloatPacket vDotH{ Max(Vector3Packet::Dot(v, halfVector), 0.f) };
+
+			const FloatPacket alpha{ roughness * roughness };
+			const FloatPacket alphaSquared{ alpha * alpha };
+			const FloatPacket denominator{ nDotH * nDotH * (alphaSquared - 1.f) + 1.f };
+			const FloatPacket distribution{ alphaSquared / (denominator * denominator * PI) };
+
+			//The 4 * nDotL * nDotV of the BRDF cancels against Smith's numerators
+			const FloatPacket k{ (roughness + 1.f) * (roughness + 1.f) * 0.125f };
+			const FloatPacket visibility{ FloatPacket{ 0.25f } / ((nDotL * (FloatPacket{ 1.f } - k) + k) * (nDotV * (FloatPacket{ 1.f } - k) + k)) };
+
+			const FloatPacket oneMinusVDotH{ FloatPacket{ 1.f } - vDotH };
+			const FloatPacket fresnelWeight{ (oneMinusVDotH * oneMinusVDotH) * (oneMinusVDotH * oneMinusVDotH) * oneMinusVDotH };
+			const FloatPacket specular{ distribution * visibility };
+			const FloatPacket f0Weight{ (FloatPacket{ 1.f } - fresnelWeight) * specular };
+			const FloatPacket constant{ fresnelWeight * specular };
+			return ColorPacket{ f0.r * f0Weight + constant, f0.g * f0Weight + constant, f0.b * f0Weight + constant };
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,317 @@
+#include "VirtualTexture.h"
+#include "Utils.h"
+#include "Vector2.h"
+#include <SDL_image.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+
+namespace dae
+{
+	namespace PageFile
+	{
+		constexpr uint32_t Magic{ 0x58545644 }; //"DVTX"
+		constexpr uint32_t Version{ 2 };
+
+		struct Header
+		{
+			uint32_t magic{ Magic };
+			uint32_t version{ Version };
+			int32_t width{};
+			int32_t height{};
+			int32_t pageSize{};
+			uint32_t numLevels{};
+			uint64_t sourceSize{};
+			int64_t sourceTimestamp{};
+			uint64_t sourceHash{};
+		};
+
+		struct LevelDesc
+		{
+			int32_t width{};
+			int32_t height{};
+			int32_t pagesX{};
+			int32_t pagesY{};
+			uint32_t firstPage{};
+		};
+	}
+
+	std::unique_ptr<VirtualTexture> VirtualTexture::LoadFromFile(const std::string& path, uint32_t numResidentPages)
+	{
+		const std::string pagePath{ path + ".vtex" };
+		if (!IsPageFileValid(path, pagePath) && !BuildPageFile(path, pagePath))
+		{
+			std::cout << "Failed to build virtual texture " << path << "\n";
+			return nullptr;
+		}
+
+		std::unique_ptr<VirtualTexture> pTexture{ new VirtualTexture() };
+		if (!pTexture->Open(pagePath, numResidentPages)) return nullptr;
+		return pTexture;
+	}
+
+	bool VirtualTexture::IsPageFileValid(const std::string& sourcePath, const std::string& pagePath)
+	{
+		PageFile::Header header{};
+		{
+			std::ifstream file{ pagePath, std::ios::binary };
+			if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+		}
+		if (header.magic != PageFile::Magic || header.version != PageFile::Version) return false;
+
+		//Same rule as the texture cache, a changed timestamp only counts when the contents changed too
+		if (header.sourceSize != FileUtils::GetFileSize(sourcePath)) return false;
+		const int64_t sourceTimestamp{ FileUtils::GetTimestamp(sourcePath) };
+		if (header.sourceTimestamp == sourceTimestamp) return true;
+		if (header.sourceHash != FileUtils::HashFile(sourcePath)) return false;
+
+		std::fstream file{ pagePath, std::ios::binary | std::ios::in | std::ios::out };
+		if (file)
+		{
+			file.seekp(offsetof(PageFile::Header, sourceTimestamp));
+			file.write(reinterpret_cast<const char*>(&sourceTimestamp), sizeof(sourceTimestamp));
+		}
+		return true;
+	}
+
+	bool VirtualTexture::BuildPageFile(const std::string& sourcePath, const std::string& pagePath)
+	{
+		//Only the decoded image and one downsampled level at a time are held, the mip chain is never in memory as a whole
+		SDL_Surface* pLoadedSurface{ IMG_Load(sourcePath.c_str()) };
+		if (!pLoadedSurface) return false;
+		SDL_Surface* pSurface{ SDL_ConvertSurfaceFormat(pLoadedSurface, SDL_PIXELFORMAT_RGBA32, 0) };
+		SDL_FreeSurface(pLoadedSurface);
+		if (!pSurface) return false;
+
+		PageFile::Header header{};
+		header.width = pSurface->w;
+		header.height = pSurface->h;
+		header.pageSize = PageSize;
+		header.sourceSize = FileUtils::GetFileSize(sourcePath);
+		header.sourceTimestamp = FileUtils::GetTimestamp(sourcePath);
+		header.sourceHash = FileUtils::HashFile(sourcePath);
+
+		//Full chain down to 1x1, the same halving as Texture so both pick the same level for a lod
+		std::vector<PageFile::LevelDesc> levelDescs{};
+		uint32_t numPages{};
+		for (int width{ header.width }, height{ header.height };; width = std::max(width / 2, 1), height = std::max(height / 2, 1))
+		{
+			const int pagesX{ (width + PageSize - 1) / PageSize };
+			const int pagesY{ (height + PageSize - 1) / PageSize };
+			levelDescs.push_back(PageFile::LevelDesc{ width, height, pagesX, pagesY, numPages });
+			numPages += pagesX * pagesY;
+			if (width == 1 && height == 1) break;
+		}
+		header.numLevels = static_cast<uint32_t>(levelDescs.size());
+
+		const std::string tempPath{ pagePath + ".tmp" };
+		{
+			std::ofstream file{ tempPath, std::ios::binary };
+			if (!file)
+			{
+				SDL_FreeSurface(pSurface);
+				return false;
+			}
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(levelDescs.data()), levelDescs.size() * sizeof(PageFile::LevelDesc));
+
+			//The first level is paged straight out of the surface, every further one is box filtered from the level before
+			std::vector<uint8_t> page(PageBytes);
+			std::vector<uint8_t> levelTexels{};
+			std::vector<uint8_t> nextLevelTexels{};
+			const uint8_t* pTexels{ static_cast<const uint8_t*>(pSurface->pixels) };
+			size_t pitch{ static_cast<size_t>(pSurface->pitch) };
+			for (size_t levelIdx{}; levelIdx < levelDescs.size(); ++levelIdx)
+			{
+				//Pages are stored row by row per level, texels outside the level are clamped to the edge
+				const PageFile::LevelDesc& levelDesc{ levelDescs[levelIdx] };
+				for (int pageY{}; pageY < levelDesc.pagesY; ++pageY)
+				{
+					for (int pageX{}; pageX < levelDesc.pagesX; ++pageX)
+					{
+						for (int y{}; y < PageSize; ++y)
+						{
+							const uint8_t* pRow{ pTexels + std::min(pageY * PageSize + y, levelDesc.height - 1) * pitch };
+							for (int x{}; x < PageSize; ++x)
+							{
+								const int srcX{ std::min(pageX * PageSize + x, levelDesc.width - 1) };
+								std::memcpy(page.data() + (x + y * PageSize) * 4, pRow + srcX * 4, 4);
+							}
+						}
+						file.write(reinterpret_cast<const char*>(page.data()), page.size());
+					}
+				}
+				if (levelIdx + 1 == levelDescs.size()) break;
+
+				const PageFile::LevelDesc& nextLevelDesc{ levelDescs[levelIdx + 1] };
+				nextLevelTexels.resize(static_cast<size_t>(nextLevelDesc.width) * nextLevelDesc.height * 4);
+				for (int y{}; y < nextLevelDesc.height; ++y)
+				{
+					const uint8_t* pRow0{ pTexels + std::min(y * 2, levelDesc.height - 1) * pitch };
+					const uint8_t* pRow1{ pTexels + std::min(y * 2 + 1, levelDesc.height - 1) * pitch };
+					for (int x{}; x < nextLevelDesc.width; ++x)
+					{
+						const int x0{ std::min(x * 2, levelDesc.width - 1) * 4 }, x1{ std::min(x * 2 + 1, levelDesc.width - 1) * 4 };
+						for (int channel{}; channel < 4; ++channel)
+						{
+							const int sum{ pRow0[x0 + channel] + pRow0[x1 + channel] + pRow1[x0 + channel] + pRow1[x1 + channel] };
+							nextLevelTexels[(x + y * nextLevelDesc.width) * 4 + channel] = static_cast<uint8_t>((sum + 2) / 4);
+						}
+					}
+				}
+
+				//The surface is not needed once the second level exists, and each level only ever needs the one before it
+				if (pSurface)
+				{
+					SDL_FreeSurface(pSurface);
+					pSurface = nullptr;
+				}
+				levelTexels.swap(nextLevelTexels);
+				pTexels = levelTexels.data();
+				pitch = static_cast<size_t>(nextLevelDesc.width) * 4;
+			}
+			if (pSurface) SDL_FreeSurface(pSurface);
+			if (!file) return false;
+		}
+
+		std::error_code error{};
+		std::filesystem::rename(tempPath, pagePath, error);
+		return !error;
+	}
+
+	bool VirtualTexture::Open(const std::string& pagePath, uint32_t numResidentPages)
+	{
+		m_PageFile.open(pagePath, std::ios::binary);
+		if (!m_PageFile) return false;
+
+		PageFile::Header header{};
+		m_PageFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!m_PageFile || header.magic != PageFile::Magic || header.version != PageFile::Version || header.pageSize != PageSize) return false;
+		if (header.numLevels == 0 || header.width <= 0 || header.height <= 0) return false;
+
+		m_Width = header.width;
+		m_Height = header.height;
+		uint32_t numPages{};
+		for (uint32_t levelIdx{}; levelIdx < header.numLevels; ++levelIdx)
+		{
+			PageFile::LevelDesc levelDesc{};
+			m_PageFile.read(reinterpret_cast<char*>(&levelDesc), sizeof(levelDesc));
+			if (!m_PageFile || levelDesc.width <= 0 || levelDesc.height <= 0 || levelDesc.firstPage != numPages
+				|| levelDesc.pagesX != (levelDesc.width + PageSize - 1) / PageSize || levelDesc.pagesY != (levelDesc.height + PageSize - 1) / PageSize) return false;
+			m_Levels.push_back(Level{ levelDesc.width, levelDesc.height, levelDesc.pagesX, levelDesc.pagesY, levelDesc.firstPage });
+			numPages = levelDesc.firstPage + levelDesc.pagesX * levelDesc.pagesY;
+		}
+		if (!m_PageFile) return false;
+		m_PageDataOffset = sizeof(header) + header.numLevels * sizeof(PageFile::LevelDesc);
+
+		m_PageTable.assign(numPages, NotResident);
+		m_PageRequests = std::vector<std::atomic<uint32_t>>(numPages);
+
+		//The single page tail of the mip chain is pinned, so every sample has something resident to fall back on
+		auto firstPinnedLevel{ std::find_if(m_Levels.begin(), m_Levels.end(), [](const Level& level) { return level.pagesX * level.pagesY == 1; }) };
+		if (firstPinnedLevel == m_Levels.end()) firstPinnedLevel = m_Levels.end() - 1;
+		const uint32_t firstPinnedPage{ firstPinnedLevel->firstPage };
+		m_NumPinnedSlots = numPages - firstPinnedPage;
+
+		const uint32_t numSlots{ std::max(numResidentPages, m_NumPinnedSlots + 1) };
+		m_PagePool.resize(numSlots * PageBytes);
+		m_SlotPages.assign(numSlots, UINT32_MAX);
+		m_SlotLastUsed.assign(numSlots, 0);
+
+		for (uint32_t pageId{ firstPinnedPage }; pageId < numPages; ++pageId)
+		{
+			if (!LoadPage(pageId, pageId - firstPinnedPage)) return false;
+		}
+		return true;
+	}
+
+	bool VirtualTexture::LoadPage(uint32_t pageId, uint32_t slot)
+	{
+		if (m_SlotPages[slot] != UINT32_MAX) m_PageTable[m_SlotPages[slot]] = NotResident;
+
+		m_PageFile.seekg(static_cast<std::streamoff>(m_PageDataOffset + pageId * PageBytes));
+		m_PageFile.read(reinterpret_cast<char*>(m_PagePool.data() + slot * PageBytes), PageBytes);
+		if (!m_PageFile)
+		{
+			m_PageFile.clear();
+			m_SlotPages[slot] = UINT32_MAX;
+			return false;
+		}
+
+		m_SlotPages[slot] = pageId;
+		m_SlotLastUsed[slot] = m_CurrentFrame;
+		m_PageTable[pageId] = static_cast<int32_t>(slot);
+		return true;
+	}
+
+	ColorRGB VirtualTexture::Sample(const Vector2& uv, float lod) const
+	{
+		const int lastLevel{ static_cast<int>(m_Levels.size()) - 1 };
+		int levelIdx{ std::clamp(static_cast<int>(lod), 0, lastLevel) };
+		bool isRequested{ false };
+
+		for (; levelIdx <= lastLevel; ++levelIdx)
+		{
+			const Level& level{ m_Levels[levelIdx] };
+			const int x{ std::clamp(static_cast<int>(uv.x * level.width), 0, level.width - 1) };
+			const int y{ std::clamp(static_cast<int>(uv.y * level.height), 0, level.height - 1) };
+			const uint32_t pageId{ level.firstPage + (x / PageSize) + (y / PageSize) * level.pagesX };
+
+			//Only the page at the wanted lod counts as demand, the coarser fallbacks are just used
+			if (!isRequested)
+			{
+				m_PageRequests[pageId].store(m_CurrentFrame, std::memory_order_relaxed);
+				isRequested = true;
+			}
+
+			const int32_t slot{ m_PageTable[pageId] };
+			if (slot == NotResident) continue;
+
+			const uint8_t* pTexel{ m_PagePool.data() + slot * PageBytes + ((x % PageSize) + (y % PageSize) * PageSize) * 4 };
+			return ColorRGB{
+				static_cast<float>(pTexel[0]) * m_ColorModifier,
+				static_cast<float>(pTexel[1]) * m_ColorModifier,
+				static_cast<float>(pTexel[2]) * m_ColorModifier
+			};
+		}
+		return ColorRGB{};
+	}
+
+	void VirtualTexture::Update()
+	{
+		//Resident pages that were touched this frame are recently used, the others are candidates to stream in
+		std::vector<uint32_t> missingPages{};
+		for (uint32_t pageId{}; pageId < m_PageTable.size(); ++pageId)
+		{
+			if (m_PageRequests[pageId].load(std::memory_order_relaxed) != m_CurrentFrame) continue;
+
+			const int32_t slot{ m_PageTable[pageId] };
+			if (slot != NotResident) m_SlotLastUsed[slot] = m_CurrentFrame;
+			else missingPages.push_back(pageId);
+		}
+
+		//Coarse pages first, they cover the most screen area and make the next fallback better
+		std::sort(missingPages.begin(), missingPages.end(), std::greater<uint32_t>{});
+		if (missingPages.size() > m_MaxPageLoadsPerFrame) missingPages.resize(m_MaxPageLoadsPerFrame);
+
+		for (const uint32_t pageId : missingPages)
+		{
+			uint32_t lruSlot{ m_NumPinnedSlots };
+			for (uint32_t slot{ m_NumPinnedSlots }; slot < m_SlotPages.size(); ++slot)
+			{
+				if (m_SlotLastUsed[slot] < m_SlotLastUsed[lruSlot]) lruSlot = slot;
+			}
+
+			//Never throw out a page that is needed for the current frame, the cache is simply full
+			if (m_SlotPages[lruSlot] != UINT32_MAX && m_SlotLastUsed[lruSlot] == m_CurrentFrame) break;
+			LoadPage(pageId, lruSlot);
+		}
+
+		++m_CurrentFrame;
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ColorRGB.h"
+
+namespace dae
+{
+	struct Vector2;
+
+	//Texture that is split into fixed size pages on disk, only the pages the rasterizer touched stay resident
+	class VirtualTexture final
+	{
+	public:
+		~VirtualTexture() = default;
+
+		VirtualTexture(const VirtualTexture&) = delete;
+		VirtualTexture(VirtualTexture&&) noexcept = delete;
+		VirtualTexture& operator=(const VirtualTexture&) = delete;
+		VirtualTexture& operator=(VirtualTexture&&) noexcept = delete;
+
+		//Builds <path>.vtex from the source image when it is missing or the image contents changed
+		static std::unique_ptr<VirtualTexture> LoadFromFile(const std::string& path, uint32_t numResidentPages = 256);
+
+		//Thread safe, samples the finest resident mip at or above lod and records the page it wanted as feedback
+		ColorRGB Sample(const Vector2& uv, float lod) const;
+
+		//Call once per frame after rendering: streams in the requested pages, evicting the least recently used ones
+		void Update();
+
+		int GetWidth() const { return m_Width; }
+		int GetHeight() const { return m_Height; }
+		size_t GetResidentMemorySize() const { return m_PagePool.size(); }
+
+	private:
+		struct Level
+		{
+			int width{};
+			int height{};
+			int pagesX{};
+			int pagesY{};
+			uint32_t firstPage{};
+		};
+
+		VirtualTexture() = default;
+
+		static constexpr int PageSize{ 128 };
+		static constexpr size_t PageBytes{ PageSize * PageSize * 4 };
+		static constexpr int32_t NotResident{ -1 };
+
+		const float m_ColorModifier{ 1.f / 255.f };
+
+		int m_Width{};
+		int m_Height{};
+		std::vector<Level> m_Levels{};
+		uint64_t m_PageDataOffset{};
+		std::ifstream m_PageFile{};
+
+		//Page table, page id -> slot in the pool
+		std::vector<int32_t> m_PageTable{};
+		//Feedback, page id -> last frame a pixel asked for it
+		mutable std::vector<std::atomic<uint32_t>> m_PageRequests{};
+
+		std::vector<uint8_t> m_PagePool{};
+		std::vector<uint32_t> m_SlotPages{};
+		std::vector<uint32_t> m_SlotLastUsed{};
+		uint32_t m_NumPinnedSlots{};
+		uint32_t m_CurrentFrame{ 1 };
+		const uint32_t m_MaxPageLoadsPerFrame{ 32 };
+
+		static bool IsPageFileValid(const std::string& sourcePath, const std::string& pagePath);
+		static bool BuildPageFile(const std::string& sourcePath, const std::string& pagePath);
+		bool Open(const std::string& pagePath, uint32_t numResidentPages);
+		bool LoadPage(uint32_t pageId, uint32_t slot);
+	};
+}
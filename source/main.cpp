@@ -78,6 +78,12 @@ int main(int argc, char* args[])
 				case SDL_SCANCODE_F7:
 					pRenderer->CycleShadingMode();
 					break;
+				case SDL_SCANCODE_F8:
+					pRenderer->ToggleFastSpecular();
+					break;
+				case SDL_SCANCODE_F9:
+					pRenderer->ToggleVariableRateShading();
+					break;
 				}
 					
 				break;